@@ -1,12 +1,17 @@
 /**
  * @file alloc.h
- * @brief Arena allocators on top of user-provided buffers.
+ * @brief Arena allocators on top of user-provided buffers (or other allocators).
  */
 
 #ifndef UGLY_ALLOC_H
 #define UGLY_ALLOC_H
 
+#include <stdalign.h> // alignas
+#include <stdatomic.h>
+#include <stdint.h> // uint32_t
+
 #include "core.h"
+#include "map.h" // used by slab allocators
 
 /// Bump allocator context.
 typedef struct {
@@ -48,19 +53,30 @@ typedef struct {
 struct allocator make_stack_allocator(stack_allocator_t *stack,
                                       void *buffer, size_t buffer_size);
 
-/// Pool allocator context;
+/// Pool allocator context.
 typedef struct {
 	struct pool_free_node *free_list_head;
 	size_t chunk_size;
+	byte_t *unused; // chunks from here on were never handed out
+	byte_t *end;
+	struct pool_slab *slabs;
+	size_t slab_size;
+	struct allocator parent;
 } pool_allocator_t;
 
 /**
  * @brief Sets up (or resets) a fixed-chunk-size pool allocator.
  *
+ * Chunks are carved out of the buffer as needed, so this takes O(1) time and
+ * leaves the buffer's pages untouched until they're actually used.
+ *
  * @param pool pool allocator state.
  * @param buffer backing memory buffer.
  * @param buffer_size buffer size, in bytes.
- * @param chunk_size maximum allocation size.
+ * @param chunk_size maximum allocation size, rounded up to a multiple of the
+ * alignment of pointers. Chunks are aligned to the largest power of two which
+ * divides their size (up to that of `max_align_t`), which suits any type
+ * whose size is the chunk size.
  *
  * @return a fixed-size allocator which supports frees and will work with
  * requests for in-place reallocation (even if it doesn't make much sense in
@@ -70,4 +86,218 @@ struct allocator make_pool_allocator(pool_allocator_t *pool,
                                      void *buffer, size_t buffer_size,
                                      size_t chunk_size);
 
+/**
+ * @brief Sets up a pool allocator which grows instead of running out of chunks.
+ *
+ * @param pool pool allocator state, should be released later.
+ * @param chunk_size maximum allocation size, see `make_pool_allocator()`.
+ * @param slab_size size, in bytes, of each slab of chunks requested from the
+ * parent allocator when the pool is empty (enough for at least one chunk).
+ * @param parent allocator which provides the pool's slabs.
+ *
+ * @return same as `make_pool_allocator()`, but without any chunks up front.
+ */
+struct allocator make_growable_pool_allocator(pool_allocator_t *pool, size_t chunk_size,
+                                              size_t slab_size, struct allocator parent);
+
+/// Gives every slab of a growable pool back to its parent, invalidating all of its chunks.
+void pool_release(pool_allocator_t *pool);
+
+/// Number of chunk caches in a concurrent pool, each mostly used by a single thread.
+#define POOL_MAGAZINES 16
+
+/// Maximum number of chunks held by each cache of a concurrent pool.
+#define POOL_MAGAZINE_SIZE 30
+
+/// Small cache of free chunks, see `concurrent_pool_allocator_t`.
+struct pool_magazine {
+	alignas(64) atomic_flag lock;
+	unsigned count;
+	void *chunks[POOL_MAGAZINE_SIZE];
+};
+
+/**
+ * @brief Thread-safe pool allocator context.
+ *
+ * Free chunks are kept in a lock-free stack whose head packs the index of the
+ * first chunk with a counter bumped by every update, so a chunk that's popped
+ * and pushed back in the meantime still makes a pending compare-and-swap fail.
+ * Chunks which were never used aren't in that stack, but are instead carved
+ * from the buffer by bumping `carved`, so setting up a pool takes no time.
+ * Each thread also gets a magazine of free chunks in every pool it uses (as
+ * long as it doesn't have to share one with too many others), so most
+ * operations only touch memory local to that thread and chunks only go to the
+ * shared stack in batches.
+ */
+typedef struct {
+	alignas(64) atomic_uint_least64_t head;
+	atomic_uint_least32_t carved;
+	byte_t *chunks;
+	size_t chunk_size;
+	uint32_t count;
+	struct pool_magazine magazines[POOL_MAGAZINES];
+} concurrent_pool_allocator_t;
+
+/**
+ * @brief Sets up (or resets) a thread-safe fixed-chunk-size pool allocator.
+ *
+ * @param pool pool allocator state, which must not be moved while in use.
+ * @param buffer backing memory buffer.
+ * @param buffer_size buffer size, in bytes.
+ * @param chunk_size maximum allocation size, rounded up so that every chunk
+ * is suitably aligned for any object.
+ *
+ * @return an allocator just like `make_pool_allocator()`'s, except that it may
+ * be used by any number of threads at the same time, with chunks being freed
+ * by threads other than those that allocated them. Free chunks cached by
+ * other threads are taken as a last resort, but allocation can still fail
+ * before the pool is actually empty while those threads hold their caches.
+ */
+struct allocator make_concurrent_pool_allocator(concurrent_pool_allocator_t *pool,
+                                                void *buffer, size_t buffer_size,
+                                                size_t chunk_size);
+
+/// Number of size classes of a slab allocator.
+#define SLAB_CLASSES 28
+
+/// Largest allocation size served by a slab allocator's own classes.
+#define SLAB_MAX_SIZE 4096
+
+/// Size, in bytes, of the slabs (and their alignment) which a slab allocator takes from its parent.
+#define SLAB_SIZE ((size_t)64 * 1024)
+
+/// Pool of chunks of a single size class, see `slab_allocator_t`.
+struct slab_class {
+	pool_allocator_t pool;
+	struct slab_allocator *owner;
+};
+
+/**
+ * @brief Slab allocator context.
+ *
+ * Small sizes are rounded up to one of a few classes, four for each power of
+ * two (like jemalloc's) so no more than 20% of a chunk is wasted, each one
+ * served by its own growable pool. Every slab is aligned to its size, so the
+ * slab holding some chunk is found by masking its address, and then looked up
+ * in an index of slabs to get its class. Addresses in no slab belong to large
+ * allocations, which go straight to the parent allocator.
+ */
+typedef struct slab_allocator {
+	struct slab_class classes[SLAB_CLASSES];
+	map_t slabs; // slab address -> class, only initialized while there are slabs
+	index_t slab_count;
+	struct allocator parent;
+} slab_allocator_t;
+
+/**
+ * @brief Sets up a slab allocator.
+ *
+ * @param slab slab allocator state, which must not be moved while in use and
+ * should be released later.
+ * @param parent allocator which provides every slab and large allocation,
+ * which must support aligned allocations (e.g. `STDLIB_ALLOCATOR`).
+ *
+ * @return a general purpose allocator, which frees (and reallocates) blocks
+ * of any size in any order. Reallocations within the same size class happen
+ * in place, while frees and small allocations only touch the parent
+ * allocator when a class needs a new slab.
+ */
+struct allocator make_slab_allocator(slab_allocator_t *slab, struct allocator parent);
+
+/**
+ * @brief Gives every slab back to the parent allocator, invalidating all
+ * small allocations. Large ones must still be freed individually.
+ */
+void slab_release(slab_allocator_t *slab);
+
+/// Number of first-level (power of two) size ranges of a TLSF allocator.
+#define TLSF_FL_COUNT 32
+
+/// Log2 of the number of second-level (linear) subdivisions of each TLSF size range.
+#define TLSF_SL_LOG2 4
+
+/// Number of second-level subdivisions of each TLSF size range.
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+
+/**
+ * @brief Two-Level Segregated Fit allocator context.
+ *
+ * Free blocks are kept in segregated lists: the first level splits sizes by
+ * powers of two, the second one splits each of those linearly. Bitmaps of
+ * non-empty lists at both levels find a free block which is big enough with
+ * a couple of bit scans, and blocks know their physical neighbours, so every
+ * operation (including coalescing on free) takes bounded, O(1) time.
+ */
+typedef struct {
+	uint32_t fl_bitmap;
+	uint32_t sl_bitmap[TLSF_FL_COUNT];
+	struct tlsf_block *free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} tlsf_allocator_t;
+
+/**
+ * @brief Sets up (or resets) a TLSF allocator.
+ *
+ * @param tlsf TLSF allocator state.
+ * @param buffer backing memory buffer.
+ * @param buffer_size buffer size, in bytes, which must fit at least a few
+ * block headers.
+ *
+ * @return a general purpose allocator for variable-sized blocks, which may be
+ * freed in any order, with a 16-byte overhead per block and worst-case
+ * constant time operations. Reallocations grow into a free block right after
+ * them, when there's one, instead of moving.
+ */
+struct allocator make_tlsf_allocator(tlsf_allocator_t *tlsf, void *buffer, size_t buffer_size);
+
+/// Growable arena allocator context.
+typedef struct {
+	struct arena_block *blocks;
+	struct arena_block *large;
+	struct arena_block *pinned;
+	bump_allocator_t bump;
+	struct allocator parent;
+	size_t block_size;
+} arena_allocator_t;
+
+/**
+ * @brief Sets up a growable arena allocator, which allocates nothing up front.
+ *
+ * @param arena arena allocator state, should be reset later.
+ * @param block_size size, in bytes, of the blocks requested from the parent
+ * allocator (bigger allocations get a block of their own, which is kept apart
+ * so that smaller ones keep filling the current block).
+ * @param parent allocator which provides the arena's blocks.
+ *
+ * @return a bump allocator which chains a new block from its parent whenever
+ * the current one fills up, instead of failing. Just like with
+ * `make_bump_allocator()`, individual blocks are never freed and only the
+ * most recent one may be reallocated (possibly moving it to a new block), as
+ * may the most recent one with a block of its own. That one can only move
+ * when no marker was saved since it was allocated, since markers refer to it.
+ */
+struct allocator make_arena_allocator(arena_allocator_t *arena, size_t block_size,
+                                      struct allocator parent);
+
+/// Gives every block back to the arena's parent, invalidating all of its allocations.
+void arena_reset(arena_allocator_t *arena);
+
+/// Saved position of an arena allocator, see `arena_save()`.
+typedef struct {
+	struct arena_block *block;
+	struct arena_block *large;
+	byte_t *current;
+} arena_marker_t;
+
+/// Marks the arena's current position, so it can be restored later.
+arena_marker_t arena_save(arena_allocator_t *arena);
+
+/**
+ * @brief Frees everything allocated since the arena's position was saved.
+ *
+ * Blocks chained since then are given back to the parent allocator. Markers
+ * must be restored in LIFO order, and any marker saved after the restored
+ * one becomes invalid.
+ */
+void arena_restore(arena_allocator_t *arena, arena_marker_t marker);
+
 #endif // UGLY_ALLOC_H
@@ -0,0 +1,123 @@
+/**
+ * @file cmap.h
+ * @brief Concurrent associative arrays, safe to share between threads.
+ */
+
+#ifndef UGLY_CMAP_H
+#define UGLY_CMAP_H
+
+#include "core.h"
+#include "hash.h" // hash_fn_t
+#include "map.h"
+
+/// One independently locked partition of a `cmap_t`, defined in cmap.c.
+struct cmap_shard;
+
+/**
+ * @brief Thread-safe hash table, split into independently locked `map_t` shards.
+ *
+ * Each key belongs to the shard given by the high bits of its hash, so threads
+ * working on different keys rarely contend for the same lock, while readers of
+ * the same shard proceed in parallel. Since shards may move their entries
+ * around on any mutation, values are always copied in and out of the map.
+ */
+typedef struct {
+	struct cmap_shard *shards;
+	void *memory;
+	unsigned shard_bits;
+	size_t key_size;
+	size_t value_size;
+	hash_fn_t hash;
+	struct allocator alloc;
+} cmap_t;
+
+/**
+ * @brief Initializes a concurrent map.
+ *
+ * @param cmap map to be initialized, should be destroyed later.
+ * @param shards number of shards (rounded up to a power of two), or 0 to pick
+ * a number proportional to the amount of online processors.
+ * @param n initial mapping capacity, spread among shards.
+ * @param key_size size, in bytes, of the map's keys.
+ * @param value_size size, in bytes, of the map's associated values.
+ * @param key_cmp key comparison function.
+ * @param key_hash key hash function, or NULL to pick one like `map_init()` does.
+ * @param alloc memory allocator to be used, which must itself be thread-safe.
+ *
+ * @return 0 on success, ENOMEM in case alloc fails or any other error number
+ * in case a lock could not be initialized.
+ */
+err_t cmap_init(cmap_t *cmap, index_t shards, index_t n, size_t key_size, size_t value_size,
+                compare_fn_t key_cmp, hash_fn_t key_hash, struct allocator alloc);
+
+/// Frees any resources allocated by the map, which must no longer be in use.
+void cmap_destroy(cmap_t *cmap);
+
+/// Gets the number of mappings contained in the map, which may be outdated by
+/// the time it returns if other threads are concurrently mutating it.
+index_t cmap_size(cmap_t *cmap);
+
+/**
+ * @brief Finds the value associated with the given key.
+ * @param value buffer where a copy of the value is written when the key is
+ * found, may be NULL to only check for its presence.
+ * @return whether the key was found.
+ */
+bool cmap_get(cmap_t *cmap, const void *key, void *value);
+
+/**
+ * @brief Puts the <key -> value> entry on the map.
+ * @return ENOMEM in case any allocation fails, a negative number if an entry
+ * with the given key already existed and had its value overwritten; zero otherwise.
+ */
+err_t cmap_insert(cmap_t *cmap, const void *key, const void *value);
+
+/**
+ * @brief Atomically reads and updates the value associated with the given key,
+ * creating a new entry for it when there's none.
+ *
+ * The procedure runs while holding its shard's exclusive lock, so it should
+ * be short and it must not access the same map.
+ *
+ * @param cmap map to be updated.
+ * @param key key to be looked up and, if needed, copied into the map.
+ * @param func procedure called with the address of the key's value, whether
+ * it was just created (in which case its value is uninitialized) and the
+ * extra forwarded argument.
+ * @param forward extra argument forwarded to func.
+ *
+ * @return 0 on success or ENOMEM in case any allocation fails.
+ */
+err_t cmap_upsert(cmap_t *cmap, const void *key,
+                  void (*func)(void *value, bool created, void *forward),
+                  void *forward);
+
+/**
+ * @brief Removes a key's entry from the map.
+ * @return 0 on success or ENOKEY if the key wasn't in the map to begin with.
+ */
+err_t cmap_remove(cmap_t *cmap, const void *key);
+
+/**
+ * @brief Iterates (in unspecified order) through all entries in the map, using
+ * multiple threads which visit different shards in parallel.
+ *
+ * Each shard is write-locked while it is being visited, so the procedure may
+ * modify values in place, but it must be thread-safe (different shards are
+ * visited at the same time) and must not call back into the same map.
+ *
+ * @param cmap map to be iterated.
+ * @param threads maximum number of threads used, or 0 to use one per online
+ * processor.
+ * @param func procedure called on each entry with an extra forwarded argument.
+ * @param forward extra argument forwarded to func.
+ *
+ * @return The iteration will be halted (on a best-effort basis) in case the
+ * procedure yields a non-zero value, which will be then returned. Returns 0
+ * otherwise, even if fewer threads than requested could be created.
+ */
+err_t cmap_for_each(cmap_t *cmap, unsigned threads,
+                    err_t (*func)(const void *key, void *value, void *forward),
+                    void *forward);
+
+#endif // UGLY_CMAP_H
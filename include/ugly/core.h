@@ -59,15 +59,45 @@ struct allocator {
 
 	/// Reference to some generic environment used by this allocator's method.
 	void *environment;
+
+	/**
+	 * @brief Optional extended allocation procedure, which may be left NULL.
+	 *
+	 * Behaves just like `method`, but its (re)allocations are aligned to (at
+	 * least) ALIGNMENT, a power of two or zero for the default alignment, and
+	 * when USABLE is not NULL they also report how many bytes of the block may
+	 * actually be used, which is never less than SIZE. Reallocations keep the
+	 * alignment, so the same one should be given every time for some block.
+	 * Blocks it provides may still be freed through `method`. Use
+	 * `allocator_resize()` to call it with a fallback to `method`.
+	 */
+	void *(*extended)(struct allocator *ctx, void *ptr, size_t size,
+	                  size_t alignment, size_t *usable);
 };
 
-/// Swaps some number of bytes at the given addresses.
+/**
+ * @brief (Re)allocates or frees memory through an allocator's extended
+ * procedure, falling back to its basic one when there's none.
+ *
+ * Without an extended procedure, the usable size is taken to be the requested
+ * one, and alignments greater than that of `max_align_t` only succeed when
+ * the allocator happens to provide them anyway. Even then, reallocations
+ * which fail leave the original block untouched.
+ *
+ * @return same as the allocator's procedures.
+ */
+void *allocator_resize(struct allocator *alloc, void *ptr, size_t size,
+                       size_t alignment, size_t *usable);
+
+/// Swaps some number of bytes at the given (non-overlapping) addresses.
 void memswap(void *a, void *b, size_t size);
 
 void *stdlib_alloc(struct allocator *ctx, void *ptr, size_t size);
+void *stdlib_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                            size_t alignment, size_t *usable);
 /// Default stdlib-based allocator.
-#define STDLIB_ALLOCATOR \
-	(struct allocator){ .method = stdlib_alloc, .environment = NULL }
+#define STDLIB_ALLOCATOR (struct allocator){ \
+	.method = stdlib_alloc, .environment = NULL, .extended = stdlib_alloc_extended }
 
 /// Gets number of elements in a STATIC array.
 #define ARRAY_SIZE(ARR) (sizeof(ARR) / sizeof((ARR)[0]))
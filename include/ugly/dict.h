@@ -0,0 +1,104 @@
+/**
+ * @file dict.h
+ * @brief Insertion-ordered associative arrays with dense storage.
+ */
+
+#ifndef UGLY_DICT_H
+#define UGLY_DICT_H
+
+#include "core.h"
+#include "hash.h" // hash_fn_t
+#include "list.h"
+
+/**
+ * @brief Compact hash table which remembers insertion order.
+ *
+ * Entries live in a dense list (in the order they were inserted), while the
+ * hash table itself only holds small integer offsets into that list. This
+ * makes iteration proportional to the number of entries (rather than to the
+ * table's capacity) and usually takes less memory than `map_t`, at the cost
+ * of an extra indirection on lookups.
+ */
+typedef struct {
+	list_t entries;
+	index_t removed;
+	index_t capacity;
+	void *index;
+	unsigned index_width;
+	size_t key_size;
+	size_t value_size;
+	size_t key_offset;
+	size_t value_offset;
+	byte_t *scratch;
+	compare_fn_t compare;
+	hash_fn_t hash;
+	struct allocator alloc;
+} dict_t;
+
+/**
+ * @brief Initializes a generic dict.
+ *
+ * @param dict dict to be initialized, should be destroyed later.
+ * @param n initial mapping capacity.
+ * @param key_size size, in bytes, of the dict's keys.
+ * @param value_size size, in bytes, of the dict's associated values.
+ * @param key_cmp key comparison function.
+ * @param key_hash key hash function, or NULL to use `wyhash()`.
+ * @param alloc memory allocator to be used.
+ *
+ * @return 0 on success or ENOMEM in case alloc fails.
+ */
+err_t dict_init(dict_t *dict, index_t n, size_t key_size, size_t value_size,
+                compare_fn_t key_cmp, hash_fn_t key_hash, struct allocator alloc);
+
+/// Frees any resources allocated by the dict.
+void dict_destroy(dict_t *dict);
+
+/// Gets the number of mappings contained in the dict.
+index_t dict_size(const dict_t *dict);
+
+/// Checks whether the dict is empty.
+inline bool dict_empty(const dict_t *dict)
+{
+	return dict_size(dict) <= 0;
+}
+
+/**
+ * @brief Finds the value associated with the given key.
+ * @return dynamic address of the associated value, or NULL when not found.
+ */
+void *dict_get(const dict_t *dict, const void *key);
+
+/**
+ * @brief Finds the value associated with the given key, appending a new entry
+ * for it when there's none (see `map_upsert()`).
+ * @return dynamic address of the associated value, or NULL in case any
+ * allocation fails.
+ */
+void *dict_upsert(dict_t *dict, const void *key, bool *created);
+
+/**
+ * @brief Puts the <key -> value> entry on the dict. Overwriting the value of an
+ * existing entry doesn't change its position in the insertion order.
+ * @return ENOMEM in case any allocation fails, a negative number if an entry
+ * with the given key already existed and had its value overwritten; zero otherwise.
+ */
+err_t dict_insert(dict_t *dict, const void *key, const void *value);
+
+/**
+ * @brief Removes a key's entry from the dict.
+ * @return 0 on success or ENOKEY if the key wasn't in the dict to begin with.
+ */
+err_t dict_remove(dict_t *dict, const void *key);
+
+/**
+ * @brief Iterates, in insertion order, through all entries in the dict,
+ * calling the given procedure on each one with an extra forwarded argument.
+ * @return The iteration will be halted in case the procedure yields a non-zero
+ * value, which will be then immediately returned. Returns 0 otherwise.
+ */
+err_t dict_for_each(const dict_t *dict,
+                    err_t (*func)(const void *key, void *value, void *forward),
+                    void *forward);
+
+#endif // UGLY_DICT_H
@@ -17,4 +17,18 @@ typedef hash_t (*hash_fn_t)(const void *ptr, size_t n);
 /// FNV-1a hashing algorithm: http://www.isthe.com/chongo/tech/comp/fnv/
 hash_t fnv_1a(const void *ptr, size_t n);
 
+/**
+ * @brief 64-bit wyhash (final version 4): https://github.com/wangyi-fudan/wyhash
+ *
+ * Reads up to 48 bytes per step and is much faster than `fnv_1a()` on long
+ * inputs, while having better quality. Results depend on machine endianness.
+ */
+hash_t wyhash(const void *ptr, size_t n);
+
+/// Hashes a 4-byte key (e.g. a 32-bit integer); N should be 4.
+hash_t hash_u32(const void *ptr, size_t n);
+
+/// Hashes an 8-byte key (e.g. a 64-bit integer or a pointer); N should be 8.
+hash_t hash_u64(const void *ptr, size_t n);
+
 #endif // UGLY_HASH_H
@@ -0,0 +1,78 @@
+/**
+ * @file image.h
+ * @brief Flat file images of containers, loaded back through memory mapping.
+ */
+
+#ifndef UGLY_IMAGE_H
+#define UGLY_IMAGE_H
+
+#include "core.h"
+#include "hash.h" // hash_fn_t
+#include "list.h"
+#include "map.h"
+
+/// Current version of the image format, bumped on every incompatible change.
+#define IMAGE_VERSION 1
+
+/// Memory-mapped image file, which backs the containers loaded from it.
+typedef struct {
+	void *address;
+	size_t length;
+} image_t;
+
+/**
+ * @brief Writes the map's buckets, as they are in memory, to an image file.
+ *
+ * Any pending incremental rehash is completed first, which is why the map
+ * isn't const. Keys and values are written verbatim, so they shouldn't hold
+ * pointers, and the file can only be read back on machines with the same
+ * byte order and builds of UGLy with the same group width (see probe.h).
+ *
+ * @return 0 on success, ENOMEM in case a migration was needed and failed, or
+ * the error number of a failed file operation.
+ */
+err_t map_save(map_t *map, const char *path);
+
+/**
+ * @brief Maps an image file made by `map_save()` and views it as a map,
+ * without copying or rehashing any of its entries.
+ *
+ * The resulting map is read-only: only `map_get()`, `map_get_many()`,
+ * `map_size()`, `map_stats()` and `map_for_each()` may be called on it, and
+ * only until the image is closed. It must not be destroyed.
+ *
+ * @param map map to be initialized.
+ * @param image image to be opened, should be closed later.
+ * @param path image file path.
+ * @param key_cmp key comparison function.
+ * @param key_hash key hash function, which must be the same (or, if NULL, have
+ * the same default) as the one of the saved map.
+ *
+ * @return 0 on success, EINVAL in case the file is not a compatible map image,
+ * or the error number of a failed file operation.
+ */
+err_t map_load(map_t *map, image_t *image, const char *path,
+               compare_fn_t key_cmp, hash_fn_t key_hash);
+
+/**
+ * @brief Writes the list's elements, as they are in memory, to an image file.
+ * @return 0 on success or the error number of a failed file operation.
+ */
+err_t list_save(const list_t *list, const char *path);
+
+/**
+ * @brief Maps an image file made by `list_save()` and views it as a list,
+ * without copying any of its elements.
+ *
+ * The resulting list is read-only: its elements may be accessed and searched,
+ * but not modified, and only until the image is closed. It must not be destroyed.
+ *
+ * @return 0 on success, EINVAL in case the file is not a compatible list image,
+ * or the error number of a failed file operation.
+ */
+err_t list_load(list_t *list, image_t *image, const char *path);
+
+/// Unmaps an image, invalidating all containers loaded from it.
+void image_close(image_t *image);
+
+#endif // UGLY_IMAGE_H
@@ -7,6 +7,25 @@
 #define UGLY_LIST_H
 
 #include "core.h"
+#include "sort.h" // sort_key_fn_t
+
+/// How a list's capacity changes as elements come and go, see `list_set_policy()`.
+struct list_policy {
+	double growth_factor; ///< Capacity multiplier when growing, must be greater than 1.
+	index_t min_capacity; ///< Capacity is never automatically set below this.
+	bool shrink; ///< Whether removals may automatically shrink capacity.
+	size_t alignment; ///< Alignment of the list's storage, or 0 for the allocator's default.
+};
+
+/// Default growth factor of lists: the golden ratio, just for fun.
+#define LIST_RESIZE_FACTOR 1.618
+
+/// Default minimum capacity of lists, once they need any.
+#define LIST_MIN_CAPACITY 8
+
+/// Policy every list starts with.
+#define LIST_DEFAULT_POLICY (struct list_policy){ \
+	.growth_factor = LIST_RESIZE_FACTOR, .min_capacity = LIST_MIN_CAPACITY, .shrink = true, .alignment = 0 }
 
 /// Dynamic array with contiguous storage, O(1) access and O(n) insert/remove.
 typedef struct {
@@ -15,6 +34,7 @@ typedef struct {
 	byte_t *data;
 	size_t elem_size;
 	struct allocator alloc;
+	struct list_policy policy;
 } list_t;
 
 /**
@@ -23,7 +43,9 @@ typedef struct {
  * @param list list to be initialized, should be destroyed later.
  * @param length initial list capacity in number of elements.
  * @param type_size size, in bytes, of each list element.
- * @param alloc memory allocator to be used (in-place reallocation support is recommended).
+ * @param alloc memory allocator to be used (in-place reallocation support is
+ * recommended). When it reports usable sizes, any slack in the blocks it
+ * provides becomes extra capacity.
  *
  * @return 0 on success or ENOMEM in case alloc fails.
  */
@@ -32,6 +54,34 @@ err_t list_init(list_t *list, index_t length, size_t type_size, struct allocator
 /// Frees any resources allocated by the given list.
 void list_destroy(list_t *list);
 
+/**
+ * @brief Changes the list's growth policy, which takes effect on its next resize.
+ *
+ * Capacity grows geometrically by the growth factor, and (if shrinking is
+ * enabled) is divided by it when less than half of the smaller capacity
+ * would be used. That gap keeps lists whose length oscillates around some
+ * threshold from reallocating over and over again. Disabling automatic
+ * shrinking removes reallocations on removals altogether, in which case
+ * `list_shrink_to_fit()` may still be called explicitly.
+ *
+ * Storage alignment can only be changed while the list holds no memory, i.e.
+ * right after being initialized with zero capacity.
+ */
+void list_set_policy(list_t *list, struct list_policy policy);
+
+/**
+ * @brief Makes sure the list can hold at least N elements without reallocating.
+ * @return 0 on success or ENOMEM in case ALLOC fails.
+ */
+err_t list_reserve(list_t *list, index_t n);
+
+/**
+ * @brief Reduces the list's capacity to its length (but no less than the
+ * minimum capacity of its policy), or as close to it as the allocator goes.
+ * @return 0 on success or ENOMEM in case ALLOC fails, leaving the list as is.
+ */
+err_t list_shrink_to_fit(list_t *list);
+
 /// Gets the number of elements currently stored in the list.
 index_t list_size(const list_t *list);
 
@@ -52,25 +102,72 @@ void *list_ref(const list_t *list, index_t index);
  */
 err_t list_insert(list_t *list, index_t index, const void *element);
 
+/**
+ * @brief Inserts N contiguous elements starting at the given index of the list.
+ * Capacity is checked once and following elements are moved only once.
+ *
+ * @return 0 on success or ENOMEM in case ALLOC fails.
+ */
+err_t list_insert_range(list_t *list, index_t index, index_t n, const void *elements);
+
 /// Equivalent to `list_insert()` at the end of the list.
 err_t list_append(list_t *list, const void *element);
 
+/// Equivalent to `list_insert_range()` at the end of the list.
+err_t list_extend(list_t *list, index_t n, const void *elements);
+
 /**
  * @brief Pops the indexed element from the list to the given address.
  * All previous elements keep their indexes and all of the next ones are moved.
  */
 void list_remove(list_t *list, index_t index, void *restrict sink);
 
+/**
+ * @brief Pops N contiguous elements, starting at the given index, from the list.
+ * @param sink address where the removed elements are copied to, may be NULL.
+ */
+void list_remove_range(list_t *list, index_t index, index_t n, void *restrict sink);
+
+/**
+ * @brief Changes the number of elements in the list, either truncating it or
+ * appending zero-initialized elements at its end.
+ *
+ * @return 0 on success or ENOMEM in case ALLOC fails.
+ */
+err_t list_resize(list_t *list, index_t length);
+
 /// Swaps list elements in the given indexes.
 void list_swap(list_t *list, index_t a, index_t b);
 
-/// Sorts list in-place using the given function to order its elements.
+/// Sorts list in-place using the given function to order its elements (see `sort_intro()`).
 void list_sort(list_t *list, compare_fn_t compare);
 
 /**
- * @brief Searches a SORTED list for some element, using an ordering function.
+ * @brief Sorts list while keeping equivalent elements in their relative order.
+ * @return 0 on success or ENOMEM in case ALLOC fails to provide a temporary
+ * buffer (see `sort_merge()`), leaving the list as is.
+ */
+err_t list_stable_sort(list_t *list, compare_fn_t compare);
+
+/**
+ * @brief Stably sorts list by the integer keys of its elements (see `sort_radix()`).
+ * @return 0 on success or ENOMEM in case ALLOC fails to provide a temporary
+ * buffer, leaving the list as is.
+ */
+err_t list_radix_sort(list_t *list, sort_key_fn_t key, unsigned key_bits);
+
+/**
+ * @brief Searches a SORTED list for some element, using an ordering function
+ * which is called as compare(key, element), just like in `bsearch()`.
  * @return Returns the index where the element was found and a negative value otherwise.
  */
 index_t list_search(const list_t *list, const void *key, compare_fn_t compare);
 
+/**
+ * @brief Finds the first element of a SORTED list which is not less than a key
+ * (see `search_lower_bound()`).
+ * @return its index, or the list's size if every element is less than the key.
+ */
+index_t list_lower_bound(const list_t *list, const void *key, compare_fn_t compare);
+
 #endif // UGLY_LIST_H
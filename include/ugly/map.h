@@ -9,18 +9,58 @@
 #include "core.h"
 #include "hash.h" // hash_fn_t
 
+/// Parallel bucket arrays of a hash table.
+struct map_buckets {
+	index_t capacity;
+	byte_t *ctrl;
+	hash_t *hashes;
+	byte_t *keys;
+	byte_t *values;
+};
+
+/// Flags which change the behaviour of a map, see `map_set_flags()`.
+enum map_flags {
+	/// Spread the work of growing the table over subsequent insertions and removals.
+	MAP_INCREMENTAL_REHASH = 1 << 0,
+	/// Use Robin Hood linear probing, which supports a higher load factor.
+	MAP_ROBIN_HOOD = 1 << 1,
+};
+
+/**
+ * @brief Snapshot of a map's performance counters, see `map_stats()`.
+ *
+ * Except for `bytes` and `tombstones`, these are only updated when UGLY is
+ * built with UGLY_MAP_STATS defined (CMake option of the same name), and are
+ * otherwise always zero. Probe lengths are counted in groups of buckets (or
+ * single buckets, in Robin Hood mode).
+ */
+struct map_stats {
+	unsigned long lookups; ///< Number of key lookups, including those made by insertions.
+	unsigned long hits; ///< Lookups which found their keys.
+	unsigned long misses; ///< Lookups which didn't.
+	unsigned long probes; ///< Total probe length of all lookups.
+	unsigned long max_probe; ///< Longest probe length seen.
+	unsigned long rehashes; ///< Number of times the table was rebuilt.
+	size_t bytes; ///< Bytes currently allocated for buckets.
+	index_t tombstones; ///< Buckets currently holding tombstones.
+};
+
 /// Generic hash table with constant amortized access, insertions and deletes.
 typedef struct {
 	index_t count;
 	index_t filled;
-	index_t capacity;
-	byte_t *keys;
-	byte_t *values;
+	struct map_buckets buckets;
+	struct map_buckets old;
+	index_t migrated;
+	unsigned flags;
 	size_t key_size;
 	size_t value_size;
 	compare_fn_t compare;
 	hash_fn_t hash;
 	struct allocator alloc;
+#ifdef UGLY_MAP_STATS
+	struct map_stats stats;
+#endif
 } map_t;
 
 /**
@@ -31,7 +71,8 @@ typedef struct {
  * @param key_size size, in bytes, of the map's keys.
  * @param value_size size, in bytes, of the map's associated values.
  * @param key_cmp key comparison function.
- * @param key_hash key hash function.
+ * @param key_hash key hash function, or NULL to hash the key's bytes with
+ * `hash_u32()`, `hash_u64()` or `wyhash()`, depending on its size.
  * @param alloc memory allocator to be used.
  *
  * @return 0 on success or ENOMEM in case alloc fails.
@@ -57,6 +98,21 @@ inline bool map_empty(const map_t *map)
  */
 void *map_get(const map_t *map, const void *key);
 
+/**
+ * @brief Finds the values associated with a batch of keys.
+ *
+ * Hashes groups of keys up front and prefetches their buckets before probing,
+ * which hides memory latency on tables that don't fit in cache.
+ *
+ * @param map map to be queried.
+ * @param n number of keys in the batch.
+ * @param keys contiguous array of N keys.
+ * @param values output array of N value addresses, NULL for keys not found.
+ *
+ * @return number of keys found in the map.
+ */
+index_t map_get_many(const map_t *map, index_t n, const void *keys, void **values);
+
 /**
  * @brief Puts the <key -> value> entry on the map.
  * @return ENOMEM in case any allocation fails, a negative number if an entry
@@ -64,12 +120,90 @@ void *map_get(const map_t *map, const void *key);
  */
 err_t map_insert(map_t *map, const void *key, const void *value);
 
+/**
+ * @brief Finds the value associated with the given key, creating a new entry
+ * for it when there's none, while hashing the key only once.
+ *
+ * Useful for "get or insert" patterns, since callers may then construct or
+ * update the value in place.
+ *
+ * @param map map to be updated.
+ * @param key key to be looked up and, if needed, copied into the map.
+ * @param created set to whether the entry was just created, in which case
+ * its value is left uninitialized.
+ *
+ * @return dynamic address of the associated value, or NULL in case any
+ * allocation fails.
+ */
+void *map_upsert(map_t *map, const void *key, bool *created);
+
+/**
+ * @brief Puts a batch of N entries, given by parallel arrays of keys and values,
+ * on the map. Just like in `map_get_many()`, buckets are prefetched in bulk.
+ * @return 0 on success or ENOMEM in case any allocation fails, in which case
+ * only a prefix of the batch will have been inserted.
+ */
+err_t map_insert_many(map_t *map, index_t n, const void *keys, const void *values);
+
 /**
  * @brief Removes a key's entry from the map.
  * @return 0 on success or ENOKEY if the key wasn't in the map to begin with.
  */
 err_t map_remove(map_t *map, const void *key);
 
+/**
+ * @brief Same as `map_get()`, for a key which the caller has already hashed
+ * (e.g. to route it somewhere else first), so it isn't hashed again.
+ *
+ * HASH must be what the map's hash function yields for the key, since it is
+ * cached along with the entry.
+ */
+void *map_get_hashed(const map_t *map, const void *key, hash_t hash);
+
+/// Same as `map_insert()`, for a key with a known hash, see `map_get_hashed()`.
+err_t map_insert_hashed(map_t *map, const void *key, hash_t hash, const void *value);
+
+/// Same as `map_upsert()`, for a key with a known hash, see `map_get_hashed()`.
+void *map_upsert_hashed(map_t *map, const void *key, hash_t hash, bool *created);
+
+/// Same as `map_remove()`, for a key with a known hash, see `map_get_hashed()`.
+err_t map_remove_hashed(map_t *map, const void *key, hash_t hash);
+
+/**
+ * @brief Rebuilds the map's table with the smallest capacity which can hold its
+ * current entries, which also purges any tombstones left behind by removals.
+ * @return 0 on success or ENOMEM in case any allocation fails.
+ */
+err_t map_compact(map_t *map);
+
+/**
+ * @brief Changes the behaviour flags (a combination of `enum map_flags`) of a map.
+ *
+ * With MAP_INCREMENTAL_REHASH, growing the table no longer moves every entry
+ * at once: old buckets are kept alive and migrated a few at a time by later
+ * calls to `map_insert()` and `map_remove()`. This bounds the latency of each
+ * insertion, at the cost of lookups checking both tables until it is done.
+ * Clearing the flag completes any pending migration.
+ *
+ * With MAP_ROBIN_HOOD, entries are displaced on insertion so that those further
+ * away from their home bucket take precedence. Unsuccessful lookups end early
+ * and removals shift entries back instead of leaving tombstones, so the table
+ * can be run at a higher load factor (saving memory) without slowing down.
+ * Changing this flag rebuilds the table.
+ *
+ * @return 0 on success or ENOMEM in case a rebuild was needed and failed.
+ */
+err_t map_set_flags(map_t *map, unsigned flags);
+
+/**
+ * @brief Takes a snapshot of the map's performance counters.
+ *
+ * This is meant for tuning hash functions, initial capacities and behaviour
+ * flags. Counters are only collected in UGLY_MAP_STATS builds, which add no
+ * cost to maps otherwise.
+ */
+struct map_stats map_stats(const map_t *map);
+
 /**
  * @brief Iterates (in unspecified order) through all entries in the map, calling
  * the given procedure on each one with an extra forwarded argument.
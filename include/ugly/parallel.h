@@ -0,0 +1,83 @@
+/**
+ * @file parallel.h
+ * @brief Multi-threaded algorithms over lists.
+ *
+ * Lists are split into contiguous chunks which are processed by a number of
+ * threads (which includes the calling one), picking chunks as they go. Lists
+ * too small to be worth splitting are processed by the calling thread alone.
+ * When threads can't be created, the remaining work is done by those which
+ * could, so these procedures only fail if their scratch memory can't be had.
+ */
+
+#ifndef UGLY_PARALLEL_H
+#define UGLY_PARALLEL_H
+
+#include "core.h"
+#include "list.h"
+
+/**
+ * @brief Calls a procedure on every element of the list, in parallel.
+ *
+ * @param list list to be iterated, which must not be resized meanwhile.
+ * @param threads maximum number of threads used, or 0 to use one per online processor.
+ * @param func procedure called on each element with an extra forwarded
+ * argument, must be thread-safe.
+ * @param forward extra argument forwarded to func.
+ */
+void parallel_for_each(list_t *list, unsigned threads,
+                       void (*func)(void *element, void *forward), void *forward);
+
+/**
+ * @brief Maps every element of a list into another one, in parallel.
+ *
+ * @param input list to be read.
+ * @param output list resized to the length of the input and then written,
+ * position by position. May be the input itself, as long as both have the
+ * same element size.
+ * @param threads maximum number of threads used, or 0 to use one per online processor.
+ * @param func procedure called with each input element, the address of the
+ * corresponding output one and an extra forwarded argument, must be thread-safe.
+ * @param forward extra argument forwarded to func.
+ *
+ * @return 0 on success or ENOMEM in case the output could not be resized.
+ */
+err_t parallel_transform(const list_t *input, list_t *output, unsigned threads,
+                         void (*func)(const void *in, void *out, void *forward),
+                         void *forward);
+
+/**
+ * @brief Folds all elements of the list into a single result, in parallel.
+ *
+ * Each chunk is accumulated into its own copy of the initial result, then the
+ * partial results are combined, in chunk order, into the final one. So the
+ * outcome is only deterministic when the initial result is an identity for
+ * both operations and they are associative.
+ *
+ * @param list list to be reduced.
+ * @param threads maximum number of threads used, or 0 to use one per online processor.
+ * @param result address holding the initial result, overwritten with the final one.
+ * @param result_size size, in bytes, of the result.
+ * @param accumulate procedure which folds an element into a partial result.
+ * @param combine procedure which folds a partial result into another one.
+ * @param forward extra argument forwarded to both procedures.
+ *
+ * @return 0 on success or ENOMEM in case the list's allocator fails to provide
+ * scratch memory for the partial results.
+ */
+err_t parallel_reduce(const list_t *list, unsigned threads, void *result, size_t result_size,
+                      void (*accumulate)(void *acc, const void *element, void *forward),
+                      void (*combine)(void *acc, const void *partial, void *forward),
+                      void *forward);
+
+/**
+ * @brief Sorts the list in place, in parallel, which is not stable.
+ *
+ * Chunks are sorted independently with `sort_intro()`, then merged pairwise
+ * in rounds, each merge being split among all threads as well.
+ *
+ * @return 0 on success or ENOMEM in case the list's allocator fails to provide
+ * a scratch buffer as big as the list, leaving it as is.
+ */
+err_t parallel_sort(list_t *list, unsigned threads, compare_fn_t compare);
+
+#endif // UGLY_PARALLEL_H
@@ -0,0 +1,154 @@
+/**
+ * @file probe.h
+ * @brief Control bytes and group probing shared by hash tables.
+ *
+ * Tables keep one control byte per bucket: either PROBE_EMPTY, PROBE_DELETED
+ * (a tombstone) or, when the bucket is in use, a 7-bit tag of the key's hash.
+ * Buckets are probed in aligned groups of PROBE_GROUP_WIDTH control bytes,
+ * which are matched against a tag all at once (with SIMD, when available).
+ * Groups are visited in a triangular sequence, which covers all of them in a
+ * power-of-two-sized table.
+ *
+ * The group width depends on the instruction set being targeted, so every
+ * translation unit sharing a table must be compiled with the same flags.
+ */
+
+#ifndef UGLY_PROBE_H
+#define UGLY_PROBE_H
+
+#include "core.h"
+#include "hash.h" // hash_t
+
+/** @cond */
+#include <assert.h>
+#include <stdint.h> // uint32_t, uint64_t
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define PROBE_GROUP_WIDTH 32
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#	define PROBE_GROUP_WIDTH 16
+#else
+#	define PROBE_GROUP_WIDTH 8
+#endif
+/** @endcond */
+
+/// Ideally, this would be tuned based on hash function and usual keys.
+#define PROBE_MAX_LOAD_FACTOR 0.75
+
+/// Full tables with less live entries than this are purged instead of growing.
+#define PROBE_PURGE_LOAD_FACTOR (PROBE_MAX_LOAD_FACTOR * 0.75)
+
+/// Control byte of an unused bucket. Those in use have their high bit unset.
+#define PROBE_EMPTY ((byte_t)0x80)
+
+/// Control byte of a bucket whose entry was removed.
+#define PROBE_DELETED ((byte_t)0xFE)
+
+static_assert((PROBE_GROUP_WIDTH & (PROBE_GROUP_WIDTH-1)) == 0,
+              "PROBE_GROUP_WIDTH must be a power of 2");
+
+/// Bitmask with one bit set for each matching bucket of a group.
+typedef uint32_t probe_mask_t;
+
+/// Checks whether a control byte indicates a bucket in use.
+static inline bool probe_is_full(byte_t ctrl)
+{
+	return (ctrl & 0x80) == 0;
+}
+
+/// Matches a group's control bytes against a tag (or PROBE_EMPTY).
+static inline probe_mask_t probe_match(const byte_t *group, byte_t tag)
+{
+#if defined(__AVX2__)
+	const __m256i ctrl = _mm256_loadu_si256((const __m256i *)group);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(ctrl, _mm256_set1_epi8(tag)));
+#elif defined(__SSE2__)
+	const __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+	probe_mask_t mask = 0;
+	for (int i = 0; i < PROBE_GROUP_WIDTH; ++i) mask |= (probe_mask_t)(group[i] == tag) << i;
+	return mask;
+#endif
+}
+
+/// Matches both EMPTY and DELETED buckets, which have their high bit set.
+static inline probe_mask_t probe_match_vacant(const byte_t *group)
+{
+#if defined(__AVX2__)
+	return _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)group));
+#elif defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+	probe_mask_t mask = 0;
+	for (int i = 0; i < PROBE_GROUP_WIDTH; ++i) mask |= (probe_mask_t)!probe_is_full(group[i]) << i;
+	return mask;
+#endif
+}
+
+/// Index of the lowest bit set in a non-zero mask.
+static inline unsigned probe_lowest_bit(probe_mask_t mask)
+{
+	assert(mask != 0);
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#else
+	unsigned i = 0;
+	while (!(mask & 1)) { mask >>= 1; ++i; }
+	return i;
+#endif
+}
+
+/// Mixes a user-provided hash so that both bucket position and tag depend on all its bits.
+static inline uint64_t probe_mix(hash_t hash)
+{
+	uint64_t h = (uint64_t)hash * 0x9E3779B97F4A7C15u;
+	return h ^ (h >> 32);
+}
+
+/// Home position (before masking) of a mixed hash.
+static inline index_t probe_home(uint64_t mixed)
+{
+	return mixed >> 7;
+}
+
+/// Control byte tag of a mixed hash.
+static inline byte_t probe_tag(uint64_t mixed)
+{
+	return mixed & 0x7F;
+}
+
+/// First group to be probed for a mixed hash, given a table of capacity MASK + 1.
+static inline index_t probe_start(uint64_t mixed, index_t mask)
+{
+	return probe_home(mixed) & mask & ~(index_t)(PROBE_GROUP_WIDTH - 1);
+}
+
+/// Finds the first vacant bucket on the probe sequence of a given (mixed) hash.
+static inline index_t probe_find_vacant(const byte_t *ctrl, index_t n, uint64_t mixed)
+{
+	const index_t mask = n - 1;
+	index_t group = probe_start(mixed, mask);
+	for (index_t stride = PROBE_GROUP_WIDTH; true; stride += PROBE_GROUP_WIDTH) {
+		const probe_mask_t vacant = probe_match_vacant(ctrl + group);
+		if (vacant) return group + probe_lowest_bit(vacant);
+		group = (group + stride) & mask;
+	}
+}
+
+/**
+ * @brief Marks a removed bucket as vacant, leaving a tombstone behind only if
+ * some probe sequence could have gone past its group (i.e. it had no empties).
+ * @return whether the bucket was made EMPTY, decreasing the table's load.
+ */
+static inline bool probe_erase(byte_t *ctrl, index_t k)
+{
+	const byte_t *group = ctrl + (k & ~(index_t)(PROBE_GROUP_WIDTH - 1));
+	const bool empty = probe_match(group, PROBE_EMPTY) != 0;
+	ctrl[k] = empty ? PROBE_EMPTY : PROBE_DELETED;
+	return empty;
+}
+
+#endif // UGLY_PROBE_H
@@ -0,0 +1,89 @@
+/**
+ * @file search.h
+ * @brief Cache-friendly searching of sorted arrays.
+ *
+ * Just like `bsearch()`, comparison functions are always called with the key
+ * being searched for as their first argument and some element as the second,
+ * so keys and elements may have different types.
+ */
+
+#ifndef UGLY_SEARCH_H
+#define UGLY_SEARCH_H
+
+#include "core.h"
+
+/**
+ * @brief Finds the first element of a SORTED array which is not less than a key.
+ *
+ * This is a branchless binary search: every step halves the range with a
+ * conditional move instead of a branch, and both of the next possible middle
+ * elements are prefetched, so it never stalls on mispredictions.
+ *
+ * @param base address of the first element.
+ * @param n number of elements.
+ * @param size size, in bytes, of each element.
+ * @param key key being searched for.
+ * @param compare ordering function, called as compare(key, element).
+ *
+ * @return index of the element found, or N if every element is less than the key.
+ */
+index_t search_lower_bound(const void *base, index_t n, size_t size,
+                           const void *key, compare_fn_t compare);
+
+/**
+ * @brief Static search tree, holding a copy of a sorted array in Eytzinger
+ * (breadth-first) order.
+ *
+ * The top levels of the tree are packed together at the start of the array,
+ * so they stay in cache across searches, and the nodes visited by the next
+ * few steps of a search are contiguous, so they can be prefetched together.
+ */
+typedef struct {
+	byte_t *nodes;
+	index_t length;
+	size_t elem_size;
+	compare_fn_t compare;
+	struct allocator alloc;
+} search_tree_t;
+
+/**
+ * @brief Builds a search tree from a SORTED array.
+ *
+ * @param tree tree to be initialized, should be destroyed later.
+ * @param base address of the first element, which is copied into the tree.
+ * @param n number of elements.
+ * @param size size, in bytes, of each element.
+ * @param compare ordering function, called as compare(key, element).
+ * @param alloc memory allocator to be used.
+ *
+ * @return 0 on success or ENOMEM in case alloc fails.
+ */
+err_t search_tree_init(search_tree_t *tree, const void *base, index_t n, size_t size,
+                       compare_fn_t compare, struct allocator alloc);
+
+/// Frees any resources allocated by the tree.
+void search_tree_destroy(search_tree_t *tree);
+
+/**
+ * @brief Finds the first element of the tree which is not less than a key.
+ * @return its index in the original sorted array, or the number of elements
+ * in case every element is less than the key.
+ */
+index_t search_tree_lower_bound(const search_tree_t *tree, const void *key);
+
+/**
+ * @brief Finds the lower bounds of a batch of keys at once.
+ *
+ * Searches for groups of keys are interleaved, one tree level at a time, so
+ * that their cache misses overlap instead of being paid one after the other.
+ *
+ * @param tree tree being searched.
+ * @param n number of keys in the batch.
+ * @param keys contiguous array of N keys.
+ * @param key_size size, in bytes, of each key.
+ * @param indexes output array of N indexes, as in `search_tree_lower_bound()`.
+ */
+void search_tree_lower_bound_many(const search_tree_t *tree, index_t n,
+                                  const void *keys, size_t key_size, index_t *indexes);
+
+#endif // UGLY_SEARCH_H
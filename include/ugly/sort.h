@@ -0,0 +1,76 @@
+/**
+ * @file sort.h
+ * @brief Sorting algorithms for contiguous arrays of fixed-size elements.
+ */
+
+#ifndef UGLY_SORT_H
+#define UGLY_SORT_H
+
+#include <stdint.h> // uint64_t
+
+#include "core.h"
+
+/**
+ * @brief Extracts an unsigned integer sorting key from some element.
+ *
+ * Signed keys can be sorted by flipping their sign bit, e.g. with
+ * `(uint64_t)x ^ (uint64_t)1 << 63` for an int64_t x.
+ */
+typedef uint64_t (*sort_key_fn_t)(const void *element);
+
+/**
+ * @brief Sorts an array in place with introsort, which is unstable.
+ *
+ * This is a quicksort which falls back to heapsort on bad partitions (so it
+ * is O(n log n) in the worst case) and to insertion sort on small ones.
+ * Element moves are specialized for common element sizes (4, 8 and 16 bytes).
+ *
+ * @param base address of the first element.
+ * @param n number of elements.
+ * @param size size, in bytes, of each element.
+ * @param compare ordering function.
+ */
+void sort_intro(void *base, index_t n, size_t size, compare_fn_t compare);
+
+/**
+ * @brief Sorts an array with a (bottom-up) merge sort, which is stable.
+ *
+ * @param base address of the first element.
+ * @param n number of elements.
+ * @param size size, in bytes, of each element.
+ * @param compare ordering function.
+ * @param alloc allocator used for a temporary buffer as big as the array.
+ *
+ * @return 0 on success or ENOMEM in case alloc fails, leaving the array as is.
+ */
+err_t sort_merge(void *base, index_t n, size_t size, compare_fn_t compare,
+                 struct allocator alloc);
+
+/**
+ * @brief Merges two sorted arrays into another one, which must not overlap them.
+ * Ties are broken in favour of the first array, so the merge is stable.
+ */
+void sort_merge_arrays(void *out, const void *a, index_t na, const void *b, index_t nb,
+                       size_t size, compare_fn_t compare);
+
+/**
+ * @brief Sorts an array by integer keys with an LSD radix sort, which is stable.
+ *
+ * Keys are processed one byte at a time, in linear time and with no comparison
+ * calls at all. Bytes which are the same for every key are skipped.
+ *
+ * @param base address of the first element.
+ * @param n number of elements.
+ * @param size size, in bytes, of each element.
+ * @param key function extracting each element's key, or NULL when elements
+ * are themselves unsigned integers with 4 or 8 bytes.
+ * @param key_bits number of (least significant) key bits to be sorted by,
+ * at most 64. Any bits above those are ignored, even in a partial last byte.
+ * @param alloc allocator used for a temporary buffer as big as the array.
+ *
+ * @return 0 on success or ENOMEM in case alloc fails, leaving the array as is.
+ */
+err_t sort_radix(void *base, index_t n, size_t size, sort_key_fn_t key, unsigned key_bits,
+                 struct allocator alloc);
+
+#endif // UGLY_SORT_H
@@ -0,0 +1,202 @@
+/**
+ * @file typed_map.h
+ * @brief Compile-time specialized (typed) hash maps.
+ *
+ * `UGLY_MAP_DEFINE(name, K, V, HASH, EQ)` generates a `name_t` hash table
+ * mapping keys of type K to values of type V, along with its procedures. The
+ * generated code uses the same layout and probing scheme as `map_t` (see
+ * probe.h), but since key and value types, HASH and EQ are all known at
+ * compile time, these can be inlined instead of going through function
+ * pointers and generic byte copies.
+ *
+ * HASH(key) must yield a `hash_t` and EQ(a, b) must be true when both keys are
+ * equal; either may be a function or a function-like macro. Hashes are mixed
+ * before use, so the identity is a fine HASH for integers.
+ *
+ * Example:
+ * ```c
+ * static inline hash_t int_hash(int x) { return x; }
+ * #define INT_EQ(a, b) ((a) == (b))
+ * UGLY_MAP_DEFINE(intmap, int, double, int_hash, INT_EQ)
+ * ```
+ * which defines `intmap_t`, `intmap_init()`, `intmap_get()`, etc.
+ */
+
+#ifndef UGLY_TYPED_MAP_H
+#define UGLY_TYPED_MAP_H
+
+#include "core.h"
+#include "hash.h" // hash_t
+#include "probe.h"
+
+/** @cond */
+#include <assert.h>
+#include <errno.h>
+#include <string.h> // memset
+#include <stdalign.h> // alignof
+#include <stdint.h> // uint64_t
+/** @endcond */
+
+/// Rounds a byte offset up so that anything can be stored at it.
+static inline size_t typed_map_align(size_t offset)
+{
+	const size_t alignment = alignof(max_align_t);
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/// Smallest valid table capacity for holding N entries.
+static inline index_t typed_map_capacity(index_t n)
+{
+	index_t capacity = PROBE_GROUP_WIDTH;
+	while (n > capacity * PROBE_MAX_LOAD_FACTOR) capacity *= 2;
+	return capacity;
+}
+
+/**
+ * @brief Defines the type `NAME_t` and its procedures, as documented below.
+ *
+ * - `err_t NAME_init(NAME_t *map, index_t n, struct allocator alloc)`:
+ *   initializes a map with room for N entries, see `map_init()`.
+ * - `void NAME_destroy(NAME_t *map)`: frees the map's resources.
+ * - `index_t NAME_size(const NAME_t *map)`: gets the number of entries.
+ * - `V *NAME_get(const NAME_t *map, K key)`: see `map_get()`.
+ * - `V *NAME_upsert(NAME_t *map, K key, bool *created)`: see `map_upsert()`.
+ * - `err_t NAME_insert(NAME_t *map, K key, V value)`: see `map_insert()`.
+ * - `err_t NAME_remove(NAME_t *map, K key)`: see `map_remove()`.
+ *
+ * All buckets are kept in a single allocation, and iteration can be done by
+ * visiting every index below `capacity` whose `probe_is_full(ctrl[i])`.
+ */
+#define UGLY_MAP_DEFINE(NAME, K, V, HASH, EQ) \
+	typedef struct { \
+		index_t count; \
+		index_t filled; \
+		index_t capacity; \
+		byte_t *ctrl; \
+		hash_t *hashes; \
+		K *keys; \
+		V *values; \
+		struct allocator alloc; \
+	} NAME##_t; \
+	\
+	/* Sets up all bucket arrays of a table with capacity N in one allocation. */ \
+	static inline err_t NAME##_alloc_buckets(NAME##_t *map, index_t n) \
+	{ \
+		const size_t hashes_offset = typed_map_align(n); \
+		const size_t keys_offset = typed_map_align(hashes_offset + n * sizeof(hash_t)); \
+		const size_t values_offset = typed_map_align(keys_offset + n * sizeof(K)); \
+		const size_t size = values_offset + n * sizeof(V); \
+		byte_t *block = map->alloc.method(&map->alloc, NULL, size); \
+		if (block == NULL) return ENOMEM; \
+		memset(block, PROBE_EMPTY, n); \
+		map->capacity = n; \
+		map->ctrl = block; \
+		map->hashes = (hash_t *)(block + hashes_offset); \
+		map->keys = (K *)(block + keys_offset); \
+		map->values = (V *)(block + values_offset); \
+		return 0; \
+	} \
+	\
+	static inline err_t NAME##_init(NAME##_t *map, index_t n, struct allocator alloc) \
+	{ \
+		assert(n >= 0); \
+		map->count = 0; \
+		map->filled = 0; \
+		map->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR; \
+		return NAME##_alloc_buckets(map, typed_map_capacity(n)); \
+	} \
+	\
+	static inline void NAME##_destroy(NAME##_t *map) \
+	{ \
+		map->alloc.method(&map->alloc, map->ctrl, 0); \
+	} \
+	\
+	static inline index_t NAME##_size(const NAME##_t *map) \
+	{ \
+		return map->count; \
+	} \
+	\
+	static inline index_t NAME##_find(const NAME##_t *map, hash_t hash, K key) \
+	{ \
+		const index_t mask = map->capacity - 1; \
+		const uint64_t mixed = probe_mix(hash); \
+		const byte_t tag = probe_tag(mixed); \
+		index_t group = probe_start(mixed, mask); \
+		for (index_t stride = PROBE_GROUP_WIDTH; true; stride += PROBE_GROUP_WIDTH) { \
+			const byte_t *ctrl = map->ctrl + group; \
+			for (probe_mask_t hits = probe_match(ctrl, tag); hits; hits &= hits - 1) { \
+				const index_t index = group + probe_lowest_bit(hits); \
+				if (map->hashes[index] == hash && (EQ(key, map->keys[index]))) return index; \
+			} \
+			if (probe_match(ctrl, PROBE_EMPTY)) return -1; \
+			group = (group + stride) & mask; \
+		} \
+	} \
+	\
+	static inline V *NAME##_get(const NAME##_t *map, K key) \
+	{ \
+		if (map->count <= 0) return NULL; \
+		const index_t k = NAME##_find(map, (HASH(key)), key); \
+		return k >= 0 ? &map->values[k] : NULL; \
+	} \
+	\
+	static inline err_t NAME##_rehash(NAME##_t *map, index_t n) \
+	{ \
+		NAME##_t old = *map; \
+		const err_t error = NAME##_alloc_buckets(map, n); \
+		if (error) return error; \
+		map->filled = 0; \
+		for (index_t i = 0; i < old.capacity; ++i) { \
+			if (!probe_is_full(old.ctrl[i])) continue; \
+			const index_t k = probe_find_vacant(map->ctrl, n, probe_mix(old.hashes[i])); \
+			map->ctrl[k] = old.ctrl[i]; \
+			map->hashes[k] = old.hashes[i]; \
+			map->keys[k] = old.keys[i]; \
+			map->values[k] = old.values[i]; \
+			map->filled++; \
+		} \
+		map->alloc.method(&map->alloc, old.ctrl, 0); \
+		return 0; \
+	} \
+	\
+	static inline V *NAME##_upsert(NAME##_t *map, K key, bool *created) \
+	{ \
+		const hash_t hash = (HASH(key)); \
+		index_t k = NAME##_find(map, hash, key); \
+		*created = k < 0; \
+		if (k >= 0) return &map->values[k]; \
+		if (map->filled + 1 > map->capacity * PROBE_MAX_LOAD_FACTOR) { \
+			const bool purge = map->count <= map->capacity * PROBE_PURGE_LOAD_FACTOR; \
+			const err_t error = NAME##_rehash(map, purge ? map->capacity : map->capacity * 2); \
+			if (error) return NULL; \
+		} \
+		const uint64_t mixed = probe_mix(hash); \
+		k = probe_find_vacant(map->ctrl, map->capacity, mixed); \
+		if (map->ctrl[k] == PROBE_EMPTY) map->filled++; \
+		map->ctrl[k] = probe_tag(mixed); \
+		map->hashes[k] = hash; \
+		map->keys[k] = key; \
+		map->count++; \
+		return &map->values[k]; \
+	} \
+	\
+	static inline err_t NAME##_insert(NAME##_t *map, K key, V value) \
+	{ \
+		bool created; \
+		V *slot = NAME##_upsert(map, key, &created); \
+		if (slot == NULL) return ENOMEM; \
+		*slot = value; \
+		return created ? 0 : -1; \
+	} \
+	\
+	static inline err_t NAME##_remove(NAME##_t *map, K key) \
+	{ \
+		if (map->count <= 0) return ENOKEY; \
+		const index_t k = NAME##_find(map, (HASH(key)), key); \
+		if (k < 0) return ENOKEY; \
+		if (probe_erase(map->ctrl, k)) map->filled--; \
+		map->count--; \
+		return 0; \
+	}
+
+#endif // UGLY_TYPED_MAP_H
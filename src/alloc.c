@@ -4,25 +4,35 @@
 #include <stdalign.h> // alignof, alignas
 #include <stddef.h> // max_align_t
 #include <stdint.h> // uintptr_t
+#include <string.h> // memcpy
+#include <stdatomic.h>
+#include <stdint.h> // uint32_t, uint64_t
 
 #include "core.h" // containerof
 
 #define MAX_ALIGNMENT alignof(max_align_t)
 
 
-static inline byte_t *align_forward(byte_t *ptr, byte_t alignment)
+static inline byte_t *align_forward(byte_t *ptr, size_t alignment)
 {
-	const unsigned modulo = (uintptr_t)ptr % alignment;
+	const size_t modulo = (uintptr_t)ptr % alignment;
 	if (modulo == 0) return ptr; // already aligned
-	const unsigned padding = alignment - modulo;
+	const size_t padding = alignment - modulo;
 	return ptr + padding;
 }
 
+static inline bool is_aligned(const void *ptr, size_t alignment)
+{
+	return alignment == 0 || (uintptr_t)ptr % alignment == 0;
+}
 
-static void *bump_alloc(struct allocator *ctx, void *ptr, size_t size)
+
+static void *bump_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                 size_t alignment, size_t *usable)
 {
 	assert(ctx != NULL);
 	bump_allocator_t *bump = (bump_allocator_t *)ctx->environment;
+	if (alignment < MAX_ALIGNMENT) alignment = MAX_ALIGNMENT;
 
 	// we don't deallocate
 	if (size == 0) {
@@ -39,16 +49,27 @@ static void *bump_alloc(struct allocator *ctx, void *ptr, size_t size)
 
 	// we always assume the current bump pointer has been bumped correctly
 	} else if (ptr == NULL) {
-		if (bump->current + size > bump->end) return NULL; // not enough space
-		bump->previous = bump->current;
+		byte_t *const aligned = align_forward(bump->current, alignment);
+		if (aligned + size > bump->end || aligned < bump->current) return NULL; // not enough space
+		bump->previous = aligned;
 		// goto BUMP;
 	}
 
 // BUMP:
 	bump->current = align_forward(bump->previous + size, MAX_ALIGNMENT);
+	// the padding up to the next block is free for the taking
+	if (usable != NULL) {
+		byte_t *const limit = bump->current < bump->end ? bump->current : bump->end;
+		*usable = limit - bump->previous;
+	}
 	return bump->previous;
 }
 
+static void *bump_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return bump_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
 struct allocator make_bump_allocator(bump_allocator_t *bump,
                                      void *buffer, size_t buffer_size)
 {
@@ -59,21 +80,25 @@ struct allocator make_bump_allocator(bump_allocator_t *bump,
 	bump->previous = bump->end; // since we haven't done any allocations yet
 
 	// return actual allocator
-	return (struct allocator){ .environment = bump, .method = bump_alloc };
+	return (struct allocator){
+		.environment = bump, .method = bump_alloc, .extended = bump_alloc_extended };
 }
 
 
 struct stack_block {
 	size_t offset_to_next;
+	size_t padding; // from the previous top of the stack, for over-aligned blocks
 	alignas(max_align_t) byte_t payload[];
 };
 
-static void *stack_alloc(struct allocator *ctx, void *ptr, size_t size)
+static void *stack_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                  size_t alignment, size_t *usable)
 {
 	assert(ctx != NULL);
 	stack_allocator_t *stack = (stack_allocator_t *)ctx->environment;
-	byte_t *user_payload;
-	struct stack_block *previous;
+	byte_t *user_payload = NULL;
+	struct stack_block *previous = NULL;
+	size_t padding = 0;
 
 	// unspecified by the allocator protocol
 	if (ptr == NULL && size == 0) {
@@ -83,13 +108,19 @@ static void *stack_alloc(struct allocator *ctx, void *ptr, size_t size)
 	} else if (ptr != NULL && size == 0) {
 		struct stack_block *block = containerof(ptr, struct stack_block, payload);
 		if ((byte_t *)block + block->offset_to_next != stack->current) return NULL; // LIFO only!
-		stack->current = (byte_t *)block;
+		stack->current = (byte_t *)block - block->padding;
 		return NULL;
 
-	// new allocation
+	// new allocation, with its header right before the (possibly over-aligned) payload
 	} else if (ptr == NULL && size != 0) {
 		previous = (struct stack_block *)stack->current;
 		user_payload = previous->payload;
+		if (alignment > alignof(struct stack_block)) {
+			user_payload = align_forward(user_payload, alignment);
+			if (user_payload >= stack->end || user_payload < previous->payload) return NULL;
+			previous = containerof(user_payload, struct stack_block, payload);
+		}
+		padding = (byte_t *)previous - stack->current;
 		// goto CHECK_AND_BUMP;
 
 	// reallocation
@@ -98,6 +129,7 @@ static void *stack_alloc(struct allocator *ctx, void *ptr, size_t size)
 		if ((byte_t *)block + block->offset_to_next != stack->current) return NULL; // LIFO only!
 		user_payload = ptr;
 		previous = block;
+		padding = block->padding;
 		// goto CHECK_AND_BUMP;
 	}
 
@@ -105,17 +137,28 @@ static void *stack_alloc(struct allocator *ctx, void *ptr, size_t size)
 	byte_t *const unaligned_next = user_payload + size;
 	if (unaligned_next > stack->end) return NULL; // not enough space
 	stack->current = align_forward(unaligned_next, alignof(struct stack_block));
+	previous->padding = padding;
 	previous->offset_to_next = stack->current - (byte_t *)previous;
+	if (usable != NULL) {
+		byte_t *const limit = stack->current < stack->end ? stack->current : stack->end;
+		*usable = limit - user_payload;
+	}
 	return user_payload;
 }
 
+static void *stack_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return stack_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
 struct allocator make_stack_allocator(stack_allocator_t *stack,
                                       void *buffer, size_t buffer_size)
 {
 	stack->current = align_forward(buffer, alignof(struct stack_block));
 	stack->end = (byte_t *)buffer + buffer_size;
 	assert(buffer_size > 0);
-	return (struct allocator){ .environment = stack, .method = stack_alloc };
+	return (struct allocator){
+		.environment = stack, .method = stack_alloc, .extended = stack_alloc_extended };
 }
 
 
@@ -123,7 +166,37 @@ struct pool_free_node {
 	struct pool_free_node *next;
 };
 
-static void *pool_alloc(struct allocator *ctx, void *ptr, size_t size)
+struct pool_slab {
+	struct pool_slab *next;
+	alignas(max_align_t) byte_t chunks[];
+};
+
+// Chunk alignment: the largest power of two dividing their size, up to MAX_ALIGNMENT.
+static inline size_t chunk_alignment(size_t chunk_size)
+{
+	const size_t lowest_bit = chunk_size & -chunk_size;
+	return lowest_bit < MAX_ALIGNMENT ? lowest_bit : MAX_ALIGNMENT;
+}
+
+// Carves a chunk out of memory that was never used, pulling a new slab if needed.
+static void *pool_carve(pool_allocator_t *pool)
+{
+	if (pool->unused == NULL || pool->end - pool->unused < (ptrdiff_t)pool->chunk_size) {
+		if (pool->parent.method == NULL) return NULL; // OOM
+		struct pool_slab *slab = pool->parent.method(&pool->parent, NULL, pool->slab_size);
+		if (slab == NULL) return NULL;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->unused = slab->chunks;
+		pool->end = (byte_t *)slab + pool->slab_size;
+	}
+	void *chunk = pool->unused;
+	pool->unused += pool->chunk_size;
+	return chunk;
+}
+
+static void *pool_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                 size_t alignment, size_t *usable)
 {
 	assert(ctx != NULL);
 	pool_allocator_t *pool = (pool_allocator_t *)ctx->environment;
@@ -139,41 +212,913 @@ static void *pool_alloc(struct allocator *ctx, void *ptr, size_t size)
 		pool->free_list_head = node;
 		return NULL;
 
-	// alloc: pop the first chunk from the free list
+	// alloc: pop the first chunk from the free list, or carve a new one
 	} else if (ptr == NULL && size != 0) {
 		if (size > pool->chunk_size) return NULL; // invalid object size
-		else if (pool->free_list_head == NULL) return NULL; // OOM
+		else if (alignment > chunk_alignment(pool->chunk_size)) return NULL; // chunks can't move
 		void *new_object = pool->free_list_head;
-		pool->free_list_head = pool->free_list_head->next;
+		if (new_object != NULL) pool->free_list_head = pool->free_list_head->next;
+		else new_object = pool_carve(pool);
+		if (new_object == NULL) return NULL; // OOM
+		if (usable != NULL) *usable = pool->chunk_size;
 		return new_object;
 
 	// reallocation
 	} else if (ptr != NULL && size != 0) {
-		return size <= pool->chunk_size ? ptr : NULL;
+		if (size > pool->chunk_size || !is_aligned(ptr, alignment)) return NULL;
+		if (usable != NULL) *usable = pool->chunk_size;
+		return ptr;
 	}
 
 	return NULL; // unreachable
 }
 
+static void *pool_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return pool_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
+static size_t round_chunk_size(size_t chunk_size)
+{
+	// chunks must be able to hold an aligned free list node
+	assert(chunk_size > 0);
+	const size_t node_alignment = alignof(struct pool_free_node);
+	if (chunk_size < sizeof(struct pool_free_node)) chunk_size = sizeof(struct pool_free_node);
+	return (chunk_size + node_alignment - 1) / node_alignment * node_alignment;
+}
+
 struct allocator make_pool_allocator(pool_allocator_t *pool,
                                      void *buffer, size_t buffer_size,
                                      size_t chunk_size)
 {
-	// if objects are too small, we have no choice but to use node alignment
-	assert(chunk_size > 0);
-	if (chunk_size < sizeof(struct pool_free_node)) {
-		chunk_size = sizeof(struct pool_free_node);
+	pool->chunk_size = round_chunk_size(chunk_size);
+	pool->free_list_head = NULL;
+	pool->unused = align_forward(buffer, chunk_alignment(pool->chunk_size));
+	pool->end = (byte_t *)buffer + buffer_size;
+	if (pool->unused > pool->end) pool->unused = pool->end;
+	pool->slabs = NULL;
+	pool->slab_size = 0;
+	pool->parent = (struct allocator){ .method = NULL };
+	return (struct allocator){
+		.environment = pool, .method = pool_alloc, .extended = pool_alloc_extended };
+}
+
+struct allocator make_growable_pool_allocator(pool_allocator_t *pool, size_t chunk_size,
+                                              size_t slab_size, struct allocator parent)
+{
+	assert(parent.method != NULL);
+	pool->chunk_size = round_chunk_size(chunk_size);
+	pool->free_list_head = NULL;
+	pool->unused = NULL;
+	pool->end = NULL;
+	pool->slabs = NULL;
+	const size_t min_slab_size = offsetof(struct pool_slab, chunks) + pool->chunk_size;
+	pool->slab_size = slab_size > min_slab_size ? slab_size : min_slab_size;
+	pool->parent = parent;
+	return (struct allocator){
+		.environment = pool, .method = pool_alloc, .extended = pool_alloc_extended };
+}
+
+void pool_release(pool_allocator_t *pool)
+{
+	while (pool->slabs != NULL) {
+		struct pool_slab *next = pool->slabs->next;
+		pool->parent.method(&pool->parent, pool->slabs, 0);
+		pool->slabs = next;
+	}
+	pool->free_list_head = NULL;
+	pool->unused = NULL;
+	pool->end = NULL;
+}
+
+/*
+ * Chunks of a concurrent pool are identified by their index plus one, so that
+ * zero means none at all. Free chunks hold the identifier of the next one in
+ * the shared stack, whose head also has an update counter in its upper half.
+ */
+
+static inline atomic_uint_least32_t *chunk_link(concurrent_pool_allocator_t *pool, uint32_t id)
+{
+	return (atomic_uint_least32_t *)(pool->chunks + (id - 1) * pool->chunk_size);
+}
+
+static inline uint32_t chunk_id(concurrent_pool_allocator_t *pool, void *chunk)
+{
+	return ((byte_t *)chunk - pool->chunks) / pool->chunk_size + 1;
+}
+
+// Pushes a chain of chunks, already linked from FIRST to LAST, onto the shared stack.
+static void pool_push(concurrent_pool_allocator_t *pool, uint32_t first, uint32_t last)
+{
+	uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+	uint64_t new_head;
+	do {
+		atomic_store_explicit(chunk_link(pool, last), (uint32_t)head, memory_order_relaxed);
+		new_head = ((head >> 32) + 1) << 32 | first;
+	} while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+	                                                memory_order_release,
+	                                                memory_order_relaxed));
+}
+
+static void *pool_pop(concurrent_pool_allocator_t *pool)
+{
+	uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+	uint64_t new_head;
+	do {
+		const uint32_t first = head;
+		if (first == 0) return NULL;
+		// if this chunk was taken meanwhile, its link is garbage but the CAS fails anyway
+		const uint32_t next = atomic_load_explicit(chunk_link(pool, first), memory_order_relaxed);
+		new_head = ((head >> 32) + 1) << 32 | next;
+	} while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+	                                                memory_order_acquire,
+	                                                memory_order_acquire));
+	return chunk_link(pool, (uint32_t)head);
+}
+
+// Reserves up to N never used chunks, returning how many and the first one's identifier.
+static uint32_t concurrent_pool_carve(concurrent_pool_allocator_t *pool, uint32_t n,
+                                      uint32_t *first)
+{
+	uint32_t carved = atomic_load_explicit(&pool->carved, memory_order_relaxed);
+	uint32_t taken;
+	do {
+		taken = pool->count - carved < n ? pool->count - carved : n;
+		if (taken == 0) return 0;
+	} while (!atomic_compare_exchange_weak_explicit(&pool->carved, &carved, carved + taken,
+	                                                memory_order_relaxed,
+	                                                memory_order_relaxed));
+	*first = carved + 1;
+	return taken;
+}
+
+/*
+ * The thread-local index only picks which magazine of a pool a thread uses,
+ * while the magazines themselves belong to that pool, so threads may use any
+ * number of pools. Magazines are never handed back when their threads exit,
+ * but any thread can still take chunks from them once everything else runs out.
+ */
+static _Thread_local unsigned thread_magazine = 0;
+static atomic_uint next_magazine = 0;
+
+static struct pool_magazine *lock_magazine(concurrent_pool_allocator_t *pool)
+{
+	if (thread_magazine == 0) {
+		thread_magazine = atomic_fetch_add_explicit(&next_magazine, 1, memory_order_relaxed) + 1;
+	}
+	struct pool_magazine *magazine = &pool->magazines[(thread_magazine - 1) % POOL_MAGAZINES];
+	if (atomic_flag_test_and_set_explicit(&magazine->lock, memory_order_acquire)) return NULL;
+	return magazine;
+}
+
+static inline void unlock_magazine(struct pool_magazine *magazine)
+{
+	atomic_flag_clear_explicit(&magazine->lock, memory_order_release);
+}
+
+// Takes a chunk cached in any magazine, including those of threads long gone.
+static void *pool_steal(concurrent_pool_allocator_t *pool)
+{
+	for (unsigned i = 0; i < POOL_MAGAZINES; ++i) {
+		struct pool_magazine *magazine = &pool->magazines[i];
+		if (atomic_flag_test_and_set_explicit(&magazine->lock, memory_order_acquire)) continue;
+		void *chunk = magazine->count > 0 ? magazine->chunks[--magazine->count] : NULL;
+		unlock_magazine(magazine);
+		if (chunk != NULL) return chunk;
+	}
+	return NULL;
+}
+
+static void *concurrent_pool_get(concurrent_pool_allocator_t *pool)
+{
+	void *chunk = NULL;
+	uint32_t first;
+	struct pool_magazine *magazine = lock_magazine(pool);
+	if (magazine == NULL) { // contended, skip the cache
+		chunk = pool_pop(pool);
+		if (chunk == NULL && concurrent_pool_carve(pool, 1, &first) > 0) chunk = chunk_link(pool, first);
+	} else {
+		// refill half of an empty magazine at once, preferring recycled chunks
+		if (magazine->count == 0) {
+			while (magazine->count < POOL_MAGAZINE_SIZE / 2) {
+				void *recycled = pool_pop(pool);
+				if (recycled == NULL) break;
+				magazine->chunks[magazine->count++] = recycled;
+			}
+			const uint32_t missing = POOL_MAGAZINE_SIZE / 2 - magazine->count;
+			const uint32_t n = concurrent_pool_carve(pool, missing, &first);
+			for (uint32_t i = 0; i < n; ++i)
+				magazine->chunks[magazine->count++] = chunk_link(pool, first + i);
+		}
+		if (magazine->count > 0) chunk = magazine->chunks[--magazine->count];
+		unlock_magazine(magazine);
+	}
+	return chunk != NULL ? chunk : pool_steal(pool);
+}
+
+static void concurrent_pool_put(concurrent_pool_allocator_t *pool, void *chunk)
+{
+	struct pool_magazine *magazine = lock_magazine(pool);
+	if (magazine == NULL) {
+		const uint32_t id = chunk_id(pool, chunk);
+		pool_push(pool, id, id);
+		return;
 	}
+
+	// flush half of a full magazine with a single push
+	if (magazine->count == POOL_MAGAZINE_SIZE) {
+		const unsigned keep = POOL_MAGAZINE_SIZE / 2;
+		const uint32_t first = chunk_id(pool, magazine->chunks[keep]);
+		uint32_t last = first;
+		for (unsigned i = keep + 1; i < POOL_MAGAZINE_SIZE; ++i) {
+			const uint32_t id = chunk_id(pool, magazine->chunks[i]);
+			atomic_store_explicit(chunk_link(pool, last), id, memory_order_relaxed);
+			last = id;
+		}
+		pool_push(pool, first, last);
+		magazine->count = keep;
+	}
+
+	magazine->chunks[magazine->count++] = chunk;
+	unlock_magazine(magazine);
+}
+
+static void *concurrent_pool_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                            size_t alignment, size_t *usable)
+{
+	assert(ctx != NULL);
+	concurrent_pool_allocator_t *pool = (concurrent_pool_allocator_t *)ctx->environment;
+
+	// unspecified by the allocator protocol
+	if (ptr == NULL && size == 0) {
+		return NULL;
+
+	// free
+	} else if (ptr != NULL && size == 0) {
+		concurrent_pool_put(pool, ptr);
+		return NULL;
+
+	// alloc
+	} else if (ptr == NULL && size != 0) {
+		if (size > pool->chunk_size) return NULL; // invalid object size
+		void *new_object = concurrent_pool_get(pool);
+		if (new_object == NULL) return NULL; // OOM
+		else if (!is_aligned(new_object, alignment)) {
+			concurrent_pool_put(pool, new_object);
+			return NULL;
+		}
+		if (usable != NULL) *usable = pool->chunk_size;
+		return new_object;
+
+	// reallocation
+	} else if (ptr != NULL && size != 0) {
+		if (size > pool->chunk_size || !is_aligned(ptr, alignment)) return NULL;
+		if (usable != NULL) *usable = pool->chunk_size;
+		return ptr;
+	}
+
+	return NULL; // unreachable
+}
+
+static void *concurrent_pool_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return concurrent_pool_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
+struct allocator make_concurrent_pool_allocator(concurrent_pool_allocator_t *pool,
+                                                void *buffer, size_t buffer_size,
+                                                size_t chunk_size)
+{
+	assert(chunk_size > 0);
+	chunk_size = (chunk_size + MAX_ALIGNMENT - 1) / MAX_ALIGNMENT * MAX_ALIGNMENT;
 	pool->chunk_size = chunk_size;
+	pool->chunks = align_forward(buffer, MAX_ALIGNMENT);
+	const size_t padding = pool->chunks - (byte_t *)buffer;
+	const size_t chunks = buffer_size > padding ? (buffer_size - padding) / chunk_size : 0;
+	pool->count = chunks < UINT32_MAX ? chunks : UINT32_MAX - 1;
 
-	// add every chunk to the free list
-	const int chunks = buffer_size / chunk_size;
-	pool->free_list_head = NULL;
-	for (int i = 0; i < chunks; ++i) {
-		struct pool_free_node *node = (struct pool_free_node *)((byte_t *)buffer + i * chunk_size);
-		node->next = pool->free_list_head;
-		pool->free_list_head = node;
+	for (unsigned i = 0; i < POOL_MAGAZINES; ++i) {
+		atomic_flag_clear(&pool->magazines[i].lock);
+		pool->magazines[i].count = 0;
 	}
 
-	return (struct allocator){ .environment = pool, .method = pool_alloc };
+	// chunks are only carved from the buffer as needed
+	atomic_init(&pool->carved, 0);
+	atomic_init(&pool->head, 0);
+
+	return (struct allocator){
+		.environment = pool,
+		.method = concurrent_pool_alloc,
+		.extended = concurrent_pool_alloc_extended,
+	};
+}
+
+
+/*
+ * Slab allocators get their slabs from their parent aligned to SLAB_SIZE, so
+ * masking any address gives the start of the slab it would belong to, which
+ * is then looked up in a map of the allocator's slabs. Since slabs take up the
+ * whole aligned region, no other block can ever be mistaken for one of them,
+ * so large allocations don't need any header and have no alignment overhead.
+ */
+
+static inline uintptr_t slab_of(void *ptr)
+{
+	return (uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1);
+}
+
+static int slab_compare(const void *a, const void *b)
+{
+	const uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Finds the class of the slab holding PTR, or NULL if it's a large allocation.
+static struct slab_class *slab_class_of(slab_allocator_t *slab, void *ptr)
+{
+	if (slab->slab_count == 0) return NULL;
+	const uintptr_t base = slab_of(ptr);
+	struct slab_class **class = map_get(&slab->slabs, &base);
+	return class != NULL ? *class : NULL;
+}
+
+// Chunk size of class K: 16 bytes apart up to 128, then four classes per power of two.
+static inline size_t class_size(unsigned k)
+{
+	if (k < 8) return 16 * (k + 1);
+	const unsigned group = (k - 8) / 4, step = (k - 8) % 4;
+	return ((size_t)128 << group) + (step + 1) * ((size_t)32 << group);
+}
+
+static inline unsigned size_class(size_t size)
+{
+	assert(size > 0 && size <= SLAB_MAX_SIZE);
+	if (size <= 128) return (size + 15) / 16 - 1;
+	unsigned log = 0;
+	for (size_t x = size - 1; x >>= 1; ) log++;
+	return 8 + (log - 7) * 4 + ((size - 1) >> (log - 2)) - 4;
+}
+
+// Provides aligned slabs to the pool of each class, keeping track of them.
+static void *slab_source(struct allocator *ctx, void *ptr, size_t size)
+{
+	struct slab_class *class = (struct slab_class *)ctx->environment;
+	slab_allocator_t *slab = class->owner;
+
+	if (size == 0) {
+		if (ptr == NULL) return NULL;
+		const uintptr_t base = slab_of(ptr);
+		map_remove(&slab->slabs, &base);
+		if (--slab->slab_count == 0) map_destroy(&slab->slabs);
+		allocator_resize(&slab->parent, ptr, 0, SLAB_SIZE, NULL);
+		return NULL;
+	}
+
+	assert(ptr == NULL);
+	assert(size <= SLAB_SIZE);
+	if (slab->slab_count == 0) {
+		const err_t err = map_init(&slab->slabs, 0, sizeof(uintptr_t), sizeof(struct slab_class *),
+		                           slab_compare, NULL, slab->parent);
+		if (err) return NULL;
+	}
+	void *new = allocator_resize(&slab->parent, NULL, SLAB_SIZE, SLAB_SIZE, NULL);
+	const uintptr_t base = (uintptr_t)new;
+	if (new == NULL || map_insert(&slab->slabs, &base, &class) != 0) {
+		if (new != NULL) allocator_resize(&slab->parent, new, 0, SLAB_SIZE, NULL);
+		if (slab->slab_count == 0) map_destroy(&slab->slabs);
+		return NULL;
+	}
+	slab->slab_count++;
+	return new;
+}
+
+static void *slab_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                 size_t alignment, size_t *usable)
+{
+	assert(ctx != NULL);
+	slab_allocator_t *slab = (slab_allocator_t *)ctx->environment;
+	struct slab_class *class = ptr != NULL ? slab_class_of(slab, ptr) : NULL;
+
+	// unspecified by the allocator protocol
+	if (ptr == NULL && size == 0) {
+		return NULL;
+
+	// large and over-aligned blocks are all up to the parent
+	} else if (ptr != NULL ? class == NULL : size > SLAB_MAX_SIZE || alignment > MAX_ALIGNMENT) {
+		return allocator_resize(&slab->parent, ptr, size, alignment, usable);
+
+	// free: back to its class' pool
+	} else if (ptr != NULL && size == 0) {
+		struct allocator pool = { .environment = &class->pool };
+		pool_alloc(&pool, ptr, 0);
+		return NULL;
+
+	// small allocations go to the pool of their size class
+	} else if (ptr == NULL) {
+		class = &slab->classes[size_class(size)];
+		struct allocator pool = { .environment = &class->pool };
+		void *new = pool_alloc(&pool, NULL, size);
+		if (new != NULL && usable != NULL) *usable = class->pool.chunk_size;
+		return new;
+
+	// small reallocations within their size class happen in place
+	} else if (size <= class->pool.chunk_size) {
+		if (usable != NULL) *usable = class->pool.chunk_size;
+		return ptr;
+
+	// others move to a bigger class (or a large block)
+	} else {
+		void *new = slab_alloc_extended(ctx, NULL, size, alignment, usable);
+		if (new == NULL) return NULL;
+		memcpy(new, ptr, class->pool.chunk_size);
+		slab_alloc_extended(ctx, ptr, 0, alignment, NULL);
+		return new;
+	}
+}
+
+static void *slab_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return slab_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
+struct allocator make_slab_allocator(slab_allocator_t *slab, struct allocator parent)
+{
+	slab->parent = parent.method != NULL ? parent : STDLIB_ALLOCATOR;
+	slab->slab_count = 0;
+	for (unsigned k = 0; k < SLAB_CLASSES; ++k) {
+		struct slab_class *class = &slab->classes[k];
+		class->owner = slab;
+		const struct allocator source = { .method = slab_source, .environment = class };
+		make_growable_pool_allocator(&class->pool, class_size(k), SLAB_SIZE, source);
+	}
+	return (struct allocator){
+		.environment = slab, .method = slab_alloc, .extended = slab_alloc_extended };
+}
+
+void slab_release(slab_allocator_t *slab)
+{
+	for (unsigned k = 0; k < SLAB_CLASSES; ++k) pool_release(&slab->classes[k].pool);
+	assert(slab->slab_count == 0);
+}
+
+
+/*
+ * TLSF blocks are laid out back to back in the buffer, each with a header
+ * holding its payload size (always a multiple of TLSF_ALIGNMENT, so the lower
+ * bits are used as flags) and the address of the previous block, which is
+ * only kept up to date when that one is free. A zero-sized block marks the
+ * end of the buffer, so that the last actual block never tries to merge past
+ * it. Free blocks hold their free list links in their payloads.
+ */
+
+#define TLSF_ALIGNMENT MAX_ALIGNMENT
+#define TLSF_BLOCK_FREE ((size_t)1)
+#define TLSF_PREV_FREE ((size_t)2)
+#define TLSF_FLAGS (TLSF_BLOCK_FREE | TLSF_PREV_FREE)
+
+// Sizes below this all go to the first range, split linearly.
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 4)
+#define TLSF_SMALL_BLOCK ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_MAX_BLOCK (((size_t)1 << (TLSF_FL_COUNT + TLSF_FL_SHIFT - 1)) - TLSF_ALIGNMENT)
+
+struct tlsf_block {
+	struct tlsf_block *prev_physical;
+	size_t header;
+	alignas(TLSF_ALIGNMENT) struct tlsf_block *next_free; // the payload starts here
+	struct tlsf_block *prev_free;
+};
+
+#define TLSF_HEADER offsetof(struct tlsf_block, next_free)
+#define TLSF_MIN_BLOCK (sizeof(struct tlsf_block) - TLSF_HEADER)
+
+static inline int log2_floor(size_t x)
+{
+#if defined(__GNUC__)
+	return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(x);
+#else
+	int log = 0;
+	while (x >>= 1) log++;
+	return log;
+#endif
+}
+
+static inline int lowest_bit(uint32_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int bit = 0;
+	while (!(x & 1)) x >>= 1, bit++;
+	return bit;
+#endif
+}
+
+static inline size_t block_size(const struct tlsf_block *block)
+{
+	return block->header & ~TLSF_FLAGS;
+}
+
+static inline void set_block_size(struct tlsf_block *block, size_t size)
+{
+	block->header = size | (block->header & TLSF_FLAGS);
+}
+
+static inline void set_flag(struct tlsf_block *block, size_t flag, bool value)
+{
+	block->header = value ? block->header | flag : block->header & ~flag;
+}
+
+static inline byte_t *block_payload(struct tlsf_block *block)
+{
+	return (byte_t *)block + TLSF_HEADER;
+}
+
+static inline struct tlsf_block *block_of(void *payload)
+{
+	return (struct tlsf_block *)((byte_t *)payload - TLSF_HEADER);
+}
+
+static inline struct tlsf_block *next_physical(struct tlsf_block *block)
+{
+	return (struct tlsf_block *)(block_payload(block) + block_size(block));
+}
+
+// Finds the free list where blocks of the given size are kept.
+static inline void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+	if (size < TLSF_SMALL_BLOCK) {
+		*fl = 0;
+		*sl = size / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT);
+	} else {
+		const int log = log2_floor(size);
+		*sl = (size >> (log - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+		*fl = log - (TLSF_FL_SHIFT - 1);
+	}
+}
+
+static void tlsf_insert(tlsf_allocator_t *tlsf, struct tlsf_block *block)
+{
+	int fl, sl;
+	tlsf_mapping(block_size(block), &fl, &sl);
+	struct tlsf_block *head = tlsf->free_lists[fl][sl];
+	block->next_free = head;
+	block->prev_free = NULL;
+	if (head != NULL) head->prev_free = block;
+	tlsf->free_lists[fl][sl] = block;
+	tlsf->fl_bitmap |= (uint32_t)1 << fl;
+	tlsf->sl_bitmap[fl] |= (uint32_t)1 << sl;
+	set_flag(block, TLSF_BLOCK_FREE, true);
+}
+
+static void tlsf_remove(tlsf_allocator_t *tlsf, struct tlsf_block *block)
+{
+	int fl, sl;
+	tlsf_mapping(block_size(block), &fl, &sl);
+	if (block->next_free != NULL) block->next_free->prev_free = block->prev_free;
+	if (block->prev_free != NULL) {
+		block->prev_free->next_free = block->next_free;
+	} else {
+		tlsf->free_lists[fl][sl] = block->next_free;
+		if (block->next_free == NULL) {
+			tlsf->sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+			if (tlsf->sl_bitmap[fl] == 0) tlsf->fl_bitmap &= ~((uint32_t)1 << fl);
+		}
+	}
+	set_flag(block, TLSF_BLOCK_FREE, false);
+}
+
+// Finds a free block of at least the given size, or NULL if there's none.
+static struct tlsf_block *tlsf_find(tlsf_allocator_t *tlsf, size_t size)
+{
+	if (size > TLSF_MAX_BLOCK) return NULL;
+	int fl, sl;
+
+	// round up to the next list, so that any block in it is big enough
+	size_t rounded = size;
+	if (size >= TLSF_SMALL_BLOCK) rounded += ((size_t)1 << (log2_floor(size) - TLSF_SL_LOG2)) - 1;
+	if (rounded <= TLSF_MAX_BLOCK) {
+		tlsf_mapping(rounded, &fl, &sl);
+		uint32_t sl_map = tlsf->sl_bitmap[fl] & (~(uint32_t)0 << sl);
+		if (sl_map == 0) {
+			const uint32_t fl_map = fl + 1 < TLSF_FL_COUNT ? tlsf->fl_bitmap & (~(uint32_t)0 << (fl + 1)) : 0;
+			if (fl_map != 0) {
+				fl = lowest_bit(fl_map);
+				sl_map = tlsf->sl_bitmap[fl];
+			}
+		}
+		if (sl_map != 0) return tlsf->free_lists[fl][lowest_bit(sl_map)];
+	}
+
+	// the head of the list itself may still be big enough (e.g. a single huge block)
+	tlsf_mapping(size, &fl, &sl);
+	struct tlsf_block *head = tlsf->free_lists[fl][sl];
+	return head != NULL && block_size(head) >= size ? head : NULL;
+}
+
+// Frees a block which is in no list, merging it with its free neighbours.
+static void tlsf_release(tlsf_allocator_t *tlsf, struct tlsf_block *block)
+{
+	if (block->header & TLSF_PREV_FREE) {
+		struct tlsf_block *prev = block->prev_physical;
+		tlsf_remove(tlsf, prev);
+		set_block_size(prev, block_size(prev) + TLSF_HEADER + block_size(block));
+		block = prev;
+	}
+	struct tlsf_block *next = next_physical(block);
+	if (next->header & TLSF_BLOCK_FREE) {
+		tlsf_remove(tlsf, next);
+		set_block_size(block, block_size(block) + TLSF_HEADER + block_size(next));
+		next = next_physical(block);
+	}
+	next->prev_physical = block;
+	set_flag(next, TLSF_PREV_FREE, true);
+	tlsf_insert(tlsf, block);
+}
+
+// Marks a block as used and gives back whatever's left after the given size.
+static void tlsf_use(tlsf_allocator_t *tlsf, struct tlsf_block *block, size_t size)
+{
+	set_flag(block, TLSF_BLOCK_FREE, false);
+	set_flag(next_physical(block), TLSF_PREV_FREE, false);
+	if (block_size(block) < size + TLSF_HEADER + TLSF_MIN_BLOCK) return;
+
+	struct tlsf_block *rest = (struct tlsf_block *)(block_payload(block) + size);
+	rest->header = block_size(block) - size - TLSF_HEADER; // and not PREV_FREE
+	set_block_size(block, size);
+	tlsf_release(tlsf, rest);
+}
+
+static inline size_t tlsf_adjust(size_t size)
+{
+	size = (size + TLSF_ALIGNMENT - 1) / TLSF_ALIGNMENT * TLSF_ALIGNMENT;
+	return size > TLSF_MIN_BLOCK ? size : TLSF_MIN_BLOCK;
+}
+
+static void *tlsf_malloc(tlsf_allocator_t *tlsf, size_t size, size_t alignment)
+{
+	if (alignment <= TLSF_ALIGNMENT) {
+		struct tlsf_block *block = tlsf_find(tlsf, size);
+		if (block == NULL) return NULL;
+		tlsf_remove(tlsf, block);
+		tlsf_use(tlsf, block, size);
+		return block_payload(block);
+	}
+
+	// over-aligned blocks leave a gap before them, big enough to be a free block
+	const size_t gap_min = TLSF_HEADER + TLSF_MIN_BLOCK;
+	if (size > TLSF_MAX_BLOCK - alignment - gap_min) return NULL;
+	struct tlsf_block *block = tlsf_find(tlsf, size + alignment + gap_min);
+	if (block == NULL) return NULL;
+	tlsf_remove(tlsf, block);
+
+	byte_t *const payload = block_payload(block);
+	byte_t *aligned = align_forward(payload, alignment);
+	if (aligned != payload && (size_t)(aligned - payload) < gap_min)
+		aligned = align_forward(payload + gap_min, alignment);
+	const size_t gap = aligned - payload;
+	if (gap > 0) {
+		struct tlsf_block *moved = block_of(aligned);
+		moved->header = (block_size(block) - gap) | TLSF_PREV_FREE;
+		moved->prev_physical = block;
+		set_block_size(block, gap - TLSF_HEADER);
+		tlsf_insert(tlsf, block);
+		block = moved;
+	}
+	tlsf_use(tlsf, block, size);
+	return block_payload(block);
+}
+
+static void *tlsf_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                 size_t alignment, size_t *usable)
+{
+	assert(ctx != NULL);
+	tlsf_allocator_t *tlsf = (tlsf_allocator_t *)ctx->environment;
+
+	// unspecified by the allocator protocol
+	if (ptr == NULL && size == 0) {
+		return NULL;
+
+	// free
+	} else if (ptr != NULL && size == 0) {
+		tlsf_release(tlsf, block_of(ptr));
+		return NULL;
+
+	// alloc
+	} else if (ptr == NULL && size != 0) {
+		if (size > TLSF_MAX_BLOCK) return NULL;
+		void *new = tlsf_malloc(tlsf, tlsf_adjust(size), alignment);
+		if (new != NULL && usable != NULL) *usable = block_size(block_of(new));
+		return new;
+	}
+
+	// reallocation: shrink in place, or grow into the next block if it's free
+	if (size > TLSF_MAX_BLOCK) return NULL;
+	struct tlsf_block *block = block_of(ptr);
+	const size_t adjusted = tlsf_adjust(size);
+	const size_t old_size = block_size(block);
+	struct tlsf_block *next = next_physical(block);
+	if (adjusted > old_size && (next->header & TLSF_BLOCK_FREE)
+	    && old_size + TLSF_HEADER + block_size(next) >= adjusted) {
+		tlsf_remove(tlsf, next);
+		set_block_size(block, old_size + TLSF_HEADER + block_size(next));
+	}
+	if (adjusted <= block_size(block)) {
+		tlsf_use(tlsf, block, adjusted);
+		if (usable != NULL) *usable = block_size(block);
+		return ptr;
+	}
+
+	// otherwise, move it
+	void *new = tlsf_malloc(tlsf, adjusted, alignment);
+	if (new == NULL) return NULL;
+	memcpy(new, ptr, old_size);
+	tlsf_release(tlsf, block);
+	if (usable != NULL) *usable = block_size(block_of(new));
+	return new;
+}
+
+static void *tlsf_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return tlsf_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
+struct allocator make_tlsf_allocator(tlsf_allocator_t *tlsf, void *buffer, size_t buffer_size)
+{
+	tlsf->fl_bitmap = 0;
+	for (int fl = 0; fl < TLSF_FL_COUNT; ++fl) {
+		tlsf->sl_bitmap[fl] = 0;
+		for (int sl = 0; sl < TLSF_SL_COUNT; ++sl) tlsf->free_lists[fl][sl] = NULL;
+	}
+
+	// a single free block spans the buffer, followed by the sentinel
+	byte_t *const start = align_forward((byte_t *)buffer + TLSF_HEADER, TLSF_ALIGNMENT) - TLSF_HEADER;
+	const size_t padding = start - (byte_t *)buffer;
+	assert(buffer_size >= padding + 2 * TLSF_HEADER + TLSF_MIN_BLOCK);
+	size_t size = (buffer_size - padding - 2 * TLSF_HEADER) / TLSF_ALIGNMENT * TLSF_ALIGNMENT;
+	if (size > TLSF_MAX_BLOCK) size = TLSF_MAX_BLOCK;
+
+	struct tlsf_block *block = (struct tlsf_block *)start;
+	block->prev_physical = NULL;
+	block->header = size;
+	struct tlsf_block *sentinel = next_physical(block);
+	sentinel->prev_physical = block;
+	sentinel->header = 0 | TLSF_PREV_FREE;
+	tlsf_insert(tlsf, block);
+
+	return (struct allocator){
+		.environment = tlsf, .method = tlsf_alloc, .extended = tlsf_alloc_extended };
+}
+
+
+struct arena_block {
+	struct arena_block *next; // previously chained block
+	size_t size; // including this header
+	alignas(max_align_t) byte_t memory[];
+};
+
+// Whether an allocation wouldn't fit in one of the arena's usual blocks.
+static inline bool arena_is_large(const arena_allocator_t *arena, size_t size, size_t alignment)
+{
+	const size_t padding = alignment > MAX_ALIGNMENT ? alignment : 0;
+	return sizeof(struct arena_block) + size + padding > arena->block_size;
+}
+
+// Chains a new block to bump from, after the current one fills up.
+static struct arena_block *arena_push(arena_allocator_t *arena)
+{
+	struct arena_block *block = arena->parent.method(&arena->parent, NULL, arena->block_size);
+	if (block == NULL) return NULL;
+	block->next = arena->blocks;
+	block->size = arena->block_size;
+	arena->blocks = block;
+	make_bump_allocator(&arena->bump, block->memory, block->size - sizeof(struct arena_block));
+	return block;
+}
+
+// Gives a large allocation a block of its own, without touching the current one.
+static void *arena_push_large(arena_allocator_t *arena, size_t size, size_t alignment,
+                              size_t *usable)
+{
+	const size_t padding = alignment > MAX_ALIGNMENT ? alignment : 0;
+	const size_t block_size = sizeof(struct arena_block) + size + padding;
+	struct arena_block *block = arena->parent.method(&arena->parent, NULL, block_size);
+	if (block == NULL) return NULL;
+	block->next = arena->large;
+	block->size = block_size;
+	arena->large = block;
+	byte_t *memory = padding > 0 ? align_forward(block->memory, alignment) : block->memory;
+	if (usable != NULL) *usable = (byte_t *)block + block_size - memory;
+	return memory;
+}
+
+static void *arena_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                  size_t alignment, size_t *usable)
+{
+	assert(ctx != NULL);
+	arena_allocator_t *arena = (arena_allocator_t *)ctx->environment;
+	struct allocator bump = { .environment = &arena->bump };
+
+	// we only free everything at once
+	if (size == 0) return NULL;
+
+	// the most recent large allocation may be reallocated as well
+	struct arena_block *const large = arena->large;
+	if (ptr != NULL && large != NULL
+	    && (byte_t *)ptr >= large->memory && (byte_t *)ptr < (byte_t *)large + large->size) {
+		const size_t room = (byte_t *)large + large->size - (byte_t *)ptr;
+		if (size <= room && is_aligned(ptr, alignment)) {
+			if (usable != NULL) *usable = room;
+			return ptr;
+		}
+		if (large == arena->pinned) return NULL; // some marker still refers to this block
+		void *new = arena_alloc_extended(ctx, NULL, size, alignment, usable);
+		if (new == NULL) return NULL;
+		memcpy(new, ptr, room < size ? room : size);
+		struct arena_block **link = &arena->large; // a new large block may be in front of it
+		while (*link != large) link = &(*link)->next;
+		*link = large->next;
+		arena->parent.method(&arena->parent, large, 0);
+		return new;
+	}
+
+	// the fast path is just bumping the current block
+	if (arena->blocks != NULL) {
+		void *new = bump_alloc_extended(&bump, ptr, size, alignment, usable);
+		if (new != NULL) return new;
+	}
+
+	// otherwise, we need a new block (and only the most recent allocation may move there)
+	size_t old_size = 0;
+	if (ptr != NULL) {
+		if (arena->blocks == NULL || (byte_t *)ptr != arena->bump.previous) return NULL;
+		byte_t *const limit = arena->bump.current < arena->bump.end ? arena->bump.current : arena->bump.end;
+		old_size = limit - (byte_t *)ptr;
+	}
+	void *new;
+	if (arena_is_large(arena, size, alignment)) {
+		new = arena_push_large(arena, size, alignment, usable);
+		if (new == NULL) return NULL;
+	} else {
+		if (arena_push(arena) == NULL) return NULL;
+		new = bump_alloc_extended(&bump, NULL, size, alignment, usable);
+		assert(new != NULL);
+	}
+	if (ptr != NULL) memcpy(new, ptr, old_size < size ? old_size : size);
+	return new;
+}
+
+static void *arena_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return arena_alloc_extended(ctx, ptr, size, 0, NULL);
+}
+
+struct allocator make_arena_allocator(arena_allocator_t *arena, size_t block_size,
+                                      struct allocator parent)
+{
+	assert(parent.method != NULL);
+	arena->blocks = NULL;
+	arena->large = NULL;
+	arena->pinned = NULL;
+	arena->bump = (bump_allocator_t){ .end = NULL, .current = NULL, .previous = NULL };
+	arena->parent = parent;
+	arena->block_size = block_size;
+	return (struct allocator){
+		.environment = arena, .method = arena_alloc, .extended = arena_alloc_extended };
+}
+
+arena_marker_t arena_save(arena_allocator_t *arena)
+{
+	arena->pinned = arena->large;
+	return (arena_marker_t){
+		.block = arena->blocks, .large = arena->large, .current = arena->bump.current };
+}
+
+void arena_restore(arena_allocator_t *arena, arena_marker_t marker)
+{
+	while (arena->large != marker.large) {
+		assert(arena->large != NULL); // marker wasn't from this arena
+		struct arena_block *next = arena->large->next;
+		arena->parent.method(&arena->parent, arena->large, 0);
+		arena->large = next;
+	}
+	arena->pinned = marker.large; // older markers may refer to it as well
+	while (arena->blocks != marker.block) {
+		assert(arena->blocks != NULL); // marker wasn't from this arena
+		struct arena_block *next = arena->blocks->next;
+		arena->parent.method(&arena->parent, arena->blocks, 0);
+		arena->blocks = next;
+	}
+
+	if (marker.block == NULL) {
+		arena->bump = (bump_allocator_t){ .end = NULL, .current = NULL, .previous = NULL };
+	} else {
+		arena->bump.end = (byte_t *)marker.block + marker.block->size;
+		arena->bump.current = marker.current;
+		arena->bump.previous = arena->bump.end; // nothing to reallocate anymore
+	}
+}
+
+void arena_reset(arena_allocator_t *arena)
+{
+	arena_restore(arena, (arena_marker_t){ .block = NULL, .large = NULL, .current = NULL });
 }
@@ -0,0 +1,247 @@
+/**
+ * @file cmap.c
+ *
+ * The concurrent map is just a power-of-two number of ordinary maps, each one
+ * guarded by its own reader-writer lock. The shard of a key is picked with the
+ * high bits of its mixed hash, while each shard's table uses the low ones, so
+ * shards are roughly balanced and their tables are not any more clustered.
+ * Keys are only hashed once, since shards are given the hash up front.
+ *
+ * Shards are aligned to cache lines, so that acquiring one lock doesn't steal
+ * the line holding its neighbour's. Lock-free readers would need some form of
+ * deferred reclamation, since a writer may rebuild (and free) the table under
+ * them at any moment; that's why we settle for shared locks instead.
+ */
+
+#define _POSIX_C_SOURCE 200809L // pthread_rwlock_t, sysconf
+
+#include "cmap.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+#include <errno.h>
+#include <limits.h> // CHAR_BIT
+#include <stdint.h> // uintptr_t
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h> // sysconf
+
+#include "core.h" // bool, byte_t
+#include "map.h"
+#include "probe.h" // probe_mix
+
+// Assumed size of a cache line, which is what each shard is aligned to.
+#define CACHE_LINE 64
+
+// Default number of shards per online processor, to keep contention low.
+#define SHARDS_PER_PROCESSOR 4
+
+// In UGLY_MAP_STATS builds, lookups update their shard's counters, so even
+// readers need exclusive access to it.
+#ifdef UGLY_MAP_STATS
+#	define read_lock pthread_rwlock_wrlock
+#else
+#	define read_lock pthread_rwlock_rdlock
+#endif
+
+struct cmap_shard {
+	alignas(CACHE_LINE) pthread_rwlock_t lock;
+	map_t map;
+};
+
+static index_t online_processors(void)
+{
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+static inline index_t shard_count(const cmap_t *cmap)
+{
+	return (index_t)1 << cmap->shard_bits;
+}
+
+// Keys are hashed just once, then both the shard and its map use that hash.
+static inline struct cmap_shard *shard_of(const cmap_t *cmap, hash_t hash)
+{
+	if (cmap->shard_bits == 0) return &cmap->shards[0];
+	const hash_t mixed = probe_mix(hash);
+	return &cmap->shards[mixed >> (sizeof(hash_t) * CHAR_BIT - cmap->shard_bits)];
+}
+
+err_t cmap_init(cmap_t *cmap, index_t shards, index_t n, size_t key_size, size_t value_size,
+                compare_fn_t key_cmp, hash_fn_t key_hash, struct allocator alloc)
+{
+	assert(shards >= 0);
+	assert(n >= 0);
+
+	if (shards == 0) shards = online_processors() * SHARDS_PER_PROCESSOR;
+	cmap->shard_bits = 0;
+	while (shard_count(cmap) < shards) cmap->shard_bits++;
+	shards = shard_count(cmap);
+
+	cmap->key_size = key_size;
+	cmap->value_size = value_size;
+	cmap->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR;
+
+	// the allocator doesn't know about our alignment, so we over-allocate
+	cmap->memory = cmap->alloc.method(&cmap->alloc, NULL,
+	                                  shards * sizeof(struct cmap_shard) + CACHE_LINE - 1);
+	if (cmap->memory == NULL) return ENOMEM;
+	const uintptr_t address = (uintptr_t)cmap->memory;
+	cmap->shards = (struct cmap_shard *)((address + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+
+	const index_t shard_capacity = (n + shards - 1) / shards;
+	index_t i;
+	err_t error = 0;
+	for (i = 0; i < shards; ++i) {
+		struct cmap_shard *shard = &cmap->shards[i];
+		error = map_init(&shard->map, shard_capacity, key_size, value_size,
+		                 key_cmp, key_hash, cmap->alloc);
+		if (error) break;
+		error = pthread_rwlock_init(&shard->lock, NULL);
+		if (error) {
+			map_destroy(&shard->map);
+			break;
+		}
+	}
+
+	if (error) {
+		while (i-- > 0) {
+			pthread_rwlock_destroy(&cmap->shards[i].lock);
+			map_destroy(&cmap->shards[i].map);
+		}
+		cmap->alloc.method(&cmap->alloc, cmap->memory, 0);
+		return error;
+	}
+
+	// shards have resolved the default hash function by now
+	cmap->hash = cmap->shards[0].map.hash;
+	return 0;
+}
+
+void cmap_destroy(cmap_t *cmap)
+{
+	for (index_t i = 0; i < shard_count(cmap); ++i) {
+		pthread_rwlock_destroy(&cmap->shards[i].lock);
+		map_destroy(&cmap->shards[i].map);
+	}
+	cmap->alloc.method(&cmap->alloc, cmap->memory, 0);
+}
+
+index_t cmap_size(cmap_t *cmap)
+{
+	index_t size = 0;
+	for (index_t i = 0; i < shard_count(cmap); ++i) {
+		struct cmap_shard *shard = &cmap->shards[i];
+		pthread_rwlock_rdlock(&shard->lock);
+		size += map_size(&shard->map);
+		pthread_rwlock_unlock(&shard->lock);
+	}
+	return size;
+}
+
+bool cmap_get(cmap_t *cmap, const void *key, void *value)
+{
+	const hash_t hash = cmap->hash(key, cmap->key_size);
+	struct cmap_shard *shard = shard_of(cmap, hash);
+	read_lock(&shard->lock);
+	const void *found = map_get_hashed(&shard->map, key, hash);
+	if (found != NULL && value != NULL) memcpy(value, found, cmap->value_size);
+	pthread_rwlock_unlock(&shard->lock);
+	return found != NULL;
+}
+
+err_t cmap_insert(cmap_t *cmap, const void *key, const void *value)
+{
+	const hash_t hash = cmap->hash(key, cmap->key_size);
+	struct cmap_shard *shard = shard_of(cmap, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	const err_t error = map_insert_hashed(&shard->map, key, hash, value);
+	pthread_rwlock_unlock(&shard->lock);
+	return error;
+}
+
+err_t cmap_upsert(cmap_t *cmap, const void *key,
+                  void (*func)(void *value, bool created, void *forward),
+                  void *forward)
+{
+	const hash_t hash = cmap->hash(key, cmap->key_size);
+	struct cmap_shard *shard = shard_of(cmap, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	bool created;
+	void *value = map_upsert_hashed(&shard->map, key, hash, &created);
+	if (value != NULL) func(value, created, forward);
+	pthread_rwlock_unlock(&shard->lock);
+	return value != NULL ? 0 : ENOMEM;
+}
+
+err_t cmap_remove(cmap_t *cmap, const void *key)
+{
+	const hash_t hash = cmap->hash(key, cmap->key_size);
+	struct cmap_shard *shard = shard_of(cmap, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	const err_t error = map_remove_hashed(&shard->map, key, hash);
+	pthread_rwlock_unlock(&shard->lock);
+	return error;
+}
+
+// State shared by all threads of a parallel iteration.
+struct visit {
+	cmap_t *cmap;
+	atomic_long next;
+	atomic_int error;
+	err_t (*func)(const void *key, void *value, void *forward);
+	void *forward;
+};
+
+// Visits whole shards until there are none left or some procedure fails.
+static void *visit_shards(void *arg)
+{
+	struct visit *visit = arg;
+	const index_t shards = shard_count(visit->cmap);
+	while (atomic_load_explicit(&visit->error, memory_order_relaxed) == 0) {
+		const index_t i = atomic_fetch_add_explicit(&visit->next, 1, memory_order_relaxed);
+		if (i >= shards) break;
+		// values may be modified in place, so readers must be kept out
+		struct cmap_shard *shard = &visit->cmap->shards[i];
+		pthread_rwlock_wrlock(&shard->lock);
+		const err_t error = map_for_each(&shard->map, visit->func, visit->forward);
+		pthread_rwlock_unlock(&shard->lock);
+		if (error) {
+			int expected = 0;
+			atomic_compare_exchange_strong(&visit->error, &expected, error);
+		}
+	}
+	return NULL;
+}
+
+err_t cmap_for_each(cmap_t *cmap, unsigned threads,
+                    err_t (*func)(const void *key, void *value, void *forward),
+                    void *forward)
+{
+	struct visit visit = { .cmap = cmap, .func = func, .forward = forward };
+	atomic_init(&visit.next, 0);
+	atomic_init(&visit.error, 0);
+
+	if (threads == 0) threads = online_processors();
+	if (threads > shard_count(cmap)) threads = shard_count(cmap);
+
+	// the calling thread also does its share, so we only spawn the remaining ones
+	pthread_t *workers = NULL;
+	unsigned spawned = 0;
+	if (threads > 1) {
+		workers = cmap->alloc.method(&cmap->alloc, NULL, (threads - 1) * sizeof(pthread_t));
+		if (workers != NULL) {
+			while (spawned < threads - 1
+			       && pthread_create(&workers[spawned], NULL, visit_shards, &visit) == 0)
+				spawned++;
+		}
+	}
+
+	visit_shards(&visit);
+	for (unsigned i = 0; i < spawned; ++i) pthread_join(workers[i], NULL);
+	if (workers != NULL) cmap->alloc.method(&cmap->alloc, workers, 0);
+
+	return atomic_load(&visit.error);
+}
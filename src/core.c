@@ -1,18 +1,205 @@
 #include "core.h"
 
-#include <stdlib.h> // realloc
+#include <stdlib.h> // realloc, aligned_alloc, free
+#include <string.h> // memcpy
+#include <stdint.h> // uint32_t, uint64_t, uintptr_t
+#include <stdalign.h> // alignof
 
+#if defined(__GLIBC__)
+#	include <malloc.h> // malloc_usable_size
+#endif
 
-void memswap(void *a, void *b, size_t size)
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+// Without compile-time AVX2 support, we may still check for it at runtime.
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define HAS_AVX2 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	include <immintrin.h>
+#	define HAS_AVX2 __builtin_cpu_supports("avx2")
+#	define AVX2_DISPATCH
+#endif
+
+// Blocks smaller than this aren't worth checking for AVX2.
+#define AVX2_THRESHOLD 64
+
+
+// Swaps 8 bytes at a time, then the remaining ones.
+static inline void swap_words(byte_t *a, byte_t *b, size_t size)
 {
+	for (uint64_t x, y; size >= sizeof(uint64_t); a += 8, b += 8, size -= 8) {
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		memcpy(a, &y, sizeof(y));
+		memcpy(b, &x, sizeof(x));
+	}
 	for (byte_t temp; size != 0; a++, b++, size--) {
-		temp = *(byte_t *)a;
-		*(byte_t *)a = *(byte_t *)b;
-		*(byte_t *)b = temp;
+		temp = *a;
+		*a = *b;
+		*b = temp;
+	}
+}
+
+// Swaps 16 bytes at a time (when SSE2 is available), then the remaining ones.
+static inline void swap_vectors(byte_t *a, byte_t *b, size_t size)
+{
+#if defined(__SSE2__)
+	for (; size >= 16; a += 16, b += 16, size -= 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)a);
+		const __m128i y = _mm_loadu_si128((const __m128i *)b);
+		_mm_storeu_si128((__m128i *)a, y);
+		_mm_storeu_si128((__m128i *)b, x);
+	}
+#endif
+	swap_words(a, b, size);
+}
+
+#if defined(HAS_AVX2)
+#	if defined(AVX2_DISPATCH)
+__attribute__((target("avx2")))
+#	endif
+static void swap_avx2(byte_t *a, byte_t *b, size_t size)
+{
+	for (; size >= 32; a += 32, b += 32, size -= 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)a);
+		const __m256i y = _mm256_loadu_si256((const __m256i *)b);
+		_mm256_storeu_si256((__m256i *)a, y);
+		_mm256_storeu_si256((__m256i *)b, x);
+	}
+	swap_vectors(a, b, size);
+}
+#endif
+
+void memswap(void *a, void *b, size_t size)
+{
+	// small fixed sizes (e.g. ints, pointers and pairs of them) need no loops
+	switch (size) {
+	case 4: {
+		uint32_t x, y;
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		memcpy(a, &y, sizeof(y));
+		memcpy(b, &x, sizeof(x));
+		return;
+	}
+	case 8: {
+		uint64_t x, y;
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		memcpy(a, &y, sizeof(y));
+		memcpy(b, &x, sizeof(x));
+		return;
+	}
+	case 16:
+		swap_vectors(a, b, 16);
+		return;
+	}
+
+#if defined(HAS_AVX2)
+	if (size >= AVX2_THRESHOLD && HAS_AVX2) {
+		swap_avx2(a, b, size);
+		return;
 	}
+#endif
+	swap_vectors(a, b, size);
 }
 
 void *stdlib_alloc(struct allocator *ctx, void *ptr, size_t size)
 {
 	return realloc(ptr, size);
 }
+
+static inline bool is_aligned(const void *ptr, size_t alignment)
+{
+	return alignment == 0 || (uintptr_t)ptr % alignment == 0;
+}
+
+// Usable size of a block from malloc, when the C library is able to tell.
+static inline size_t usable_size(void *ptr, size_t size)
+{
+#if defined(__GLIBC__)
+	return malloc_usable_size(ptr);
+#else
+	return size;
+#endif
+}
+
+void *stdlib_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                            size_t alignment, size_t *usable)
+{
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	} else if (alignment <= alignof(max_align_t)) {
+		void *new = realloc(ptr, size);
+		if (new != NULL && usable != NULL) *usable = usable_size(new, size);
+		return new;
+	}
+
+	// realloc may lose the alignment, in which case we move the block ourselves,
+	// so the aligned block is set aside first and the original one is never lost
+	const size_t rounded = (size + alignment - 1) / alignment * alignment;
+	void *aligned = aligned_alloc(alignment, rounded);
+	if (aligned == NULL) return NULL;
+	if (ptr == NULL) {
+		if (usable != NULL) *usable = usable_size(aligned, size);
+		return aligned;
+	}
+
+	void *new = realloc(ptr, size);
+	if (new == NULL) {
+		free(aligned);
+		return NULL;
+	} else if (is_aligned(new, alignment)) {
+		free(aligned);
+	} else {
+		memcpy(aligned, new, size);
+		free(new);
+		new = aligned;
+	}
+	if (usable != NULL) *usable = usable_size(new, size);
+	return new;
+}
+
+void *allocator_resize(struct allocator *alloc, void *ptr, size_t size,
+                       size_t alignment, size_t *usable)
+{
+	if (alloc->extended != NULL)
+		return alloc->extended(alloc, ptr, size, alignment, usable);
+
+	if (ptr == NULL || size == 0 || alignment <= alignof(max_align_t)) {
+		void *new = alloc->method(alloc, ptr, size);
+		if (new == NULL || size == 0) return new;
+		if (!is_aligned(new, alignment)) {
+			alloc->method(alloc, new, 0);
+			return NULL;
+		}
+		if (usable != NULL) *usable = size;
+		return new;
+	}
+
+	// a reallocation which loses the alignment can't be undone, so just like in
+	// stdlib_alloc_extended(), an aligned block is set aside before touching PTR
+	void *aligned = alloc->method(alloc, NULL, size);
+	if (aligned == NULL) return NULL;
+	if (!is_aligned(aligned, alignment)) {
+		alloc->method(alloc, aligned, 0);
+		return NULL;
+	}
+	void *new = alloc->method(alloc, ptr, size);
+	if (new == NULL) {
+		alloc->method(alloc, aligned, 0);
+		return NULL;
+	} else if (is_aligned(new, alignment)) {
+		alloc->method(alloc, aligned, 0);
+	} else {
+		memcpy(aligned, new, size);
+		alloc->method(alloc, new, 0);
+		new = aligned;
+	}
+	if (usable != NULL) *usable = size;
+	return new;
+}
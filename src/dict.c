@@ -0,0 +1,284 @@
+/**
+ * @file dict.c
+ *
+ * Dicts are split into a dense list of entries, kept in insertion order, and
+ * an open-addressing index table mapping buckets to offsets into that list.
+ * Index slots are only as wide (1, 2, 4 or 8 bytes) as the table's capacity
+ * requires, so the index is usually much smaller than the entries themselves.
+ *
+ * Each entry holds its key's hash, then the key and the value. Stored hashes
+ * always have their lowest bit set, so that removed entries can be marked by
+ * zeroing theirs, to be skipped during iteration. Removals also leave a DUMMY
+ * slot in the index; these and removed entries are only dropped when the index
+ * is rebuilt, which happens once both live and removed entries fill it up.
+ */
+
+#include "dict.h"
+
+#include <assert.h>
+#include <string.h> // memcpy, memmove, memset
+#include <errno.h>
+#include <stdalign.h> // alignof
+#include <stdint.h> // int8_t, int16_t, int32_t, int64_t
+
+#include "core.h" // byte_t, bool, STDLIB_ALLOCATOR
+#include "hash.h" // wyhash
+#include "list.h"
+#include "probe.h" // probe_mix, probe_home
+
+
+// Python uses this, so it should be good enough for us.
+#define MAX_LOAD_FACTOR (2.0 / 3.0)
+
+#define MIN_CAPACITY 8
+
+#define SLOT_EMPTY (-1)
+#define SLOT_DUMMY (-2)
+
+#define LIVE_BIT ((hash_t)1)
+
+
+// Any type whose size is a multiple of this can be stored at such an alignment.
+static size_t align_of_size(size_t size)
+{
+	size_t alignment = 1;
+	while (alignment < alignof(max_align_t) && size % (2 * alignment) == 0) alignment *= 2;
+	return alignment;
+}
+
+static size_t align_up(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+static unsigned index_width(index_t capacity)
+{
+	if (capacity <= INT8_MAX + 1) return 1;
+	else if (capacity <= INT16_MAX + 1) return 2;
+	else if (capacity <= INT32_MAX + 1L) return 4;
+	else return 8;
+}
+
+static inline index_t load_slot(const dict_t *dict, index_t i)
+{
+	switch (dict->index_width) {
+		case 1: return ((const int8_t *)dict->index)[i];
+		case 2: return ((const int16_t *)dict->index)[i];
+		case 4: return ((const int32_t *)dict->index)[i];
+		default: return ((const int64_t *)dict->index)[i];
+	}
+}
+
+static inline void store_slot(dict_t *dict, index_t i, index_t entry)
+{
+	switch (dict->index_width) {
+		case 1: ((int8_t *)dict->index)[i] = entry; break;
+		case 2: ((int16_t *)dict->index)[i] = entry; break;
+		case 4: ((int32_t *)dict->index)[i] = entry; break;
+		default: ((int64_t *)dict->index)[i] = entry; break;
+	}
+}
+
+static inline byte_t *entry_at(const dict_t *dict, index_t i)
+{
+	return dict->entries.data + i * dict->entries.elem_size;
+}
+
+static inline hash_t entry_hash(const dict_t *dict, index_t i)
+{
+	return *(const hash_t *)entry_at(dict, i);
+}
+
+/**
+ * Finds the index bucket of a key, setting ENTRY to the offset of its entry.
+ * When the key isn't there, ENTRY is set to -1 and the bucket returned is
+ * where it should be indexed.
+ */
+static index_t find_slot(const dict_t *dict, hash_t hash, const void *key, index_t *entry)
+{
+	// this procedure does not loop infinitely because there will always be
+	// at least some empty buckets due to a maximum load factor smaller than 1
+	const index_t mask = dict->capacity - 1;
+	index_t vacant = -1;
+	for (index_t i = probe_home(probe_mix(hash)) & mask; true; i = (i + 1) & mask) {
+		const index_t slot = load_slot(dict, i);
+		if (slot == SLOT_EMPTY) {
+			*entry = -1;
+			return vacant >= 0 ? vacant : i;
+		} else if (slot == SLOT_DUMMY) {
+			if (vacant < 0) vacant = i;
+		} else if (entry_hash(dict, slot) == hash
+		           && dict->compare(key, entry_at(dict, slot) + dict->key_offset) == 0) {
+			*entry = slot;
+			return i;
+		}
+	}
+}
+
+// Drops removed entries and reindexes the remaining ones with a new capacity.
+static err_t rebuild_index(dict_t *dict, index_t capacity)
+{
+	const unsigned width = index_width(capacity);
+	void *index = dict->alloc.method(&dict->alloc, NULL, capacity * width);
+	if (index == NULL) return ENOMEM;
+	memset(index, 0xFF, capacity * width); // all SLOT_EMPTY
+	if (dict->index != NULL) dict->alloc.method(&dict->alloc, dict->index, 0);
+	dict->index = index;
+	dict->index_width = width;
+	dict->capacity = capacity;
+
+	// slide live entries down, keeping their order
+	const size_t entry_size = dict->entries.elem_size;
+	index_t live = 0;
+	for (index_t i = 0; i < dict->entries.length; ++i) {
+		if (!(entry_hash(dict, i) & LIVE_BIT)) continue;
+		if (live != i) memmove(entry_at(dict, live), entry_at(dict, i), entry_size);
+		live++;
+	}
+	dict->entries.length = live;
+	dict->removed = 0;
+
+	// we already know these are all distinct, so just look for empty buckets
+	const index_t mask = capacity - 1;
+	for (index_t e = 0; e < live; ++e) {
+		index_t i = probe_home(probe_mix(entry_hash(dict, e))) & mask;
+		while (load_slot(dict, i) != SLOT_EMPTY) i = (i + 1) & mask;
+		store_slot(dict, i, e);
+	}
+
+	return 0;
+}
+
+// Smallest capacity which holds N entries while leaving as much room for more.
+static index_t capacity_for(index_t n)
+{
+	index_t capacity = MIN_CAPACITY;
+	while (2 * n > capacity * MAX_LOAD_FACTOR) capacity *= 2;
+	return capacity;
+}
+
+err_t dict_init(dict_t *dict, index_t n, size_t key_size, size_t value_size,
+                compare_fn_t key_cmp, hash_fn_t key_hash, struct allocator alloc)
+{
+	assert(n >= 0);
+	assert(key_size > 0);
+	assert(key_cmp != NULL);
+
+	// lay out entries so that both keys and values are properly aligned
+	const size_t key_alignment = align_of_size(key_size);
+	const size_t value_alignment = align_of_size(value_size);
+	size_t entry_alignment = alignof(hash_t);
+	if (key_alignment > entry_alignment) entry_alignment = key_alignment;
+	if (value_alignment > entry_alignment) entry_alignment = value_alignment;
+	dict->key_offset = align_up(sizeof(hash_t), key_alignment);
+	dict->value_offset = align_up(dict->key_offset + key_size, value_alignment);
+	const size_t entry_size = align_up(dict->value_offset + value_size, entry_alignment);
+
+	dict->removed = 0;
+	dict->key_size = key_size;
+	dict->value_size = value_size;
+	dict->compare = key_cmp;
+	dict->hash = key_hash != NULL ? key_hash : wyhash;
+	dict->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR;
+
+	err_t error = list_init(&dict->entries, n, entry_size, dict->alloc);
+	if (error) return error;
+	dict->scratch = dict->alloc.method(&dict->alloc, NULL, entry_size);
+	if (dict->scratch == NULL) {
+		list_destroy(&dict->entries);
+		return ENOMEM;
+	}
+	dict->index = NULL;
+	error = rebuild_index(dict, capacity_for(n));
+	if (error) {
+		dict->alloc.method(&dict->alloc, dict->scratch, 0);
+		list_destroy(&dict->entries);
+	}
+	return error;
+}
+
+void dict_destroy(dict_t *dict)
+{
+	dict->alloc.method(&dict->alloc, dict->index, 0);
+	dict->alloc.method(&dict->alloc, dict->scratch, 0);
+	list_destroy(&dict->entries);
+}
+
+index_t dict_size(const dict_t *dict)
+{
+	return list_size(&dict->entries) - dict->removed;
+}
+
+extern inline bool dict_empty(const dict_t *dict);
+
+void *dict_get(const dict_t *dict, const void *key)
+{
+	if (dict_size(dict) <= 0) return NULL;
+	const hash_t hash = dict->hash(key, dict->key_size) | LIVE_BIT;
+	index_t entry;
+	find_slot(dict, hash, key, &entry);
+	return entry >= 0 ? entry_at(dict, entry) + dict->value_offset : NULL;
+}
+
+void *dict_upsert(dict_t *dict, const void *key, bool *created)
+{
+	const hash_t hash = dict->hash(key, dict->key_size) | LIVE_BIT;
+	index_t entry;
+	index_t bucket = find_slot(dict, hash, key, &entry);
+	*created = entry < 0;
+	if (entry >= 0) return entry_at(dict, entry) + dict->value_offset;
+
+	// removed entries still occupy (dummy) index slots, so they count as load
+	if (list_size(&dict->entries) + 1 > dict->capacity * MAX_LOAD_FACTOR) {
+		const err_t error = rebuild_index(dict, capacity_for(dict_size(dict) + 1));
+		if (error) return NULL;
+		bucket = find_slot(dict, hash, key, &entry);
+	}
+
+	// append a new entry (whose value is up to the caller) and index it
+	memcpy(dict->scratch, &hash, sizeof(hash_t));
+	memcpy(dict->scratch + dict->key_offset, key, dict->key_size);
+	const err_t error = list_append(&dict->entries, dict->scratch);
+	if (error) return NULL;
+	entry = list_size(&dict->entries) - 1;
+	store_slot(dict, bucket, entry);
+	return entry_at(dict, entry) + dict->value_offset;
+}
+
+err_t dict_insert(dict_t *dict, const void *key, const void *value)
+{
+	bool created;
+	void *slot = dict_upsert(dict, key, &created);
+	if (slot == NULL) return ENOMEM;
+	memcpy(slot, value, dict->value_size);
+	return created ? 0 : -1;
+}
+
+err_t dict_remove(dict_t *dict, const void *key)
+{
+	if (dict_size(dict) <= 0) return ENOKEY;
+
+	const hash_t hash = dict->hash(key, dict->key_size) | LIVE_BIT;
+	index_t entry;
+	const index_t bucket = find_slot(dict, hash, key, &entry);
+	if (entry < 0) return ENOKEY;
+
+	// entries are only actually dropped when rebuilding the index
+	store_slot(dict, bucket, SLOT_DUMMY);
+	memset(entry_at(dict, entry), 0, sizeof(hash_t));
+	dict->removed++;
+	return 0;
+}
+
+err_t dict_for_each(const dict_t *dict,
+                    err_t (*proc)(const void *k, void *v, void *fwd), void *forward)
+{
+	err_t err = 0;
+	for (index_t i = 0; i < list_size(&dict->entries); ++i) {
+		if (!(entry_hash(dict, i) & LIVE_BIT)) continue;
+		byte_t *entry = entry_at(dict, i);
+		err = proc(entry + dict->key_offset, entry + dict->value_offset, forward);
+		if (err) break;
+	}
+	return err;
+}
@@ -1,6 +1,7 @@
 #include "hash.h"
 
-#include <stdint.h> // uint32_t
+#include <stdint.h> // uint32_t, uint64_t
+#include <string.h> // memcpy
 
 
 hash_t fnv_1a(const void *ptr, size_t n)
@@ -13,3 +14,120 @@ hash_t fnv_1a(const void *ptr, size_t n)
 	}
 	return hash;
 }
+
+
+static const uint64_t WYP[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+	0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+};
+
+// Full 64x64 -> 128-bit multiplication, low half in A and high half in B.
+static inline void wymum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+	const __uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	const uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	const uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	const uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+	wymum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t wyr8(const byte_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t wyr4(const byte_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t wyr3(const byte_t *p, size_t k)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+hash_t wyhash(const void *ptr, size_t n)
+{
+	const byte_t *p = ptr;
+	uint64_t seed = wymix(WYP[0], WYP[1]); // as if seeded with zero
+	uint64_t a, b;
+
+	// short keys are read with (possibly overlapping) 4-byte loads
+	if (n <= 16) {
+		if (n >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((n >> 3) << 2));
+			b = (wyr4(p + n - 4) << 32) | wyr4(p + n - 4 - ((n >> 3) << 2));
+		} else if (n > 0) {
+			a = wyr3(p, n);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+
+	// longer ones go through three independent 16-byte lanes per step
+	} else {
+		size_t i = n;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wymix(wyr8(p) ^ WYP[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ WYP[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ WYP[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(wyr8(p) ^ WYP[1], wyr8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+
+	a ^= WYP[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ WYP[0] ^ n, b ^ WYP[1]);
+}
+
+// Mixes a single 64-bit word, like wyhash does for its final step.
+static inline uint64_t wyhash64(uint64_t a, uint64_t b)
+{
+	a ^= WYP[0];
+	b ^= WYP[1];
+	wymum(&a, &b);
+	return wymix(a ^ WYP[0], b ^ WYP[1]);
+}
+
+hash_t hash_u32(const void *ptr, size_t n)
+{
+	return wyhash64(wyr4(ptr), n);
+}
+
+hash_t hash_u64(const void *ptr, size_t n)
+{
+	return wyhash64(wyr8(ptr), n);
+}
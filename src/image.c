@@ -0,0 +1,296 @@
+/**
+ * @file image.c
+ *
+ * Images are a fixed-size header followed by the raw arrays of a container,
+ * each one starting at an offset aligned to SECTION_ALIGNMENT. Since mappings
+ * are page-aligned, loaded arrays are then as aligned as any allocator would
+ * have made them, so containers can point straight into the mapping.
+ *
+ * The header records everything which changes the meaning of those bytes:
+ * format version, byte order, the sizes of our integer types and, for maps,
+ * the probing group width and behaviour flags.
+ */
+
+#define _POSIX_C_SOURCE 200809L // open, fstat, mmap
+
+#include "image.h"
+
+#include <assert.h>
+#include <string.h> // memcmp, memcpy, memset
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h> // uint32_t, uint64_t
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+
+#include "core.h"
+#include "hash.h" // hash_u32, hash_u64, wyhash
+#include "list.h"
+#include "map.h"
+#include "probe.h" // PROBE_GROUP_WIDTH, PROBE_EMPTY, PROBE_DELETED, probe_is_full
+
+#define SECTION_ALIGNMENT 64
+
+#define BYTE_ORDER_MARK 0x01020304
+
+enum image_kind {
+	IMAGE_MAP = 1,
+	IMAGE_LIST = 2,
+};
+
+struct image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t kind;
+	uint32_t byte_order;
+	uint32_t word_sizes; // sizeof(hash_t) | sizeof(index_t) << 8
+	uint32_t group_width;
+	uint32_t flags;
+	uint64_t count;
+	uint64_t filled;
+	uint64_t capacity;
+	uint64_t key_size;
+	uint64_t value_size;
+	uint64_t offsets[4];
+};
+
+static const char MAGIC[8] = "UGLYIMG";
+
+static inline uint64_t align_section(uint64_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~(uint64_t)(SECTION_ALIGNMENT - 1);
+}
+
+static void init_header(struct image_header *header, enum image_kind kind)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, MAGIC, sizeof(MAGIC));
+	header->version = IMAGE_VERSION;
+	header->kind = kind;
+	header->byte_order = BYTE_ORDER_MARK;
+	header->word_sizes = sizeof(hash_t) | sizeof(index_t) << 8;
+}
+
+// Writes the header and then each of the N sections at their (aligned) offsets.
+static err_t write_image(const char *path, struct image_header *header,
+                         int n, const void *sections[], const uint64_t sizes[])
+{
+	uint64_t offset = align_section(sizeof(*header));
+	for (int i = 0; i < n; ++i) {
+		header->offsets[i] = offset;
+		offset = align_section(offset + sizes[i]);
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) return errno;
+	errno = 0;
+
+	static const byte_t padding[SECTION_ALIGNMENT] = {0};
+	uint64_t written = 0;
+	bool ok = fwrite(header, sizeof(*header), 1, file) == 1;
+	written += sizeof(*header);
+	for (int i = 0; ok && i < n; ++i) {
+		const uint64_t gap = header->offsets[i] - written;
+		ok = fwrite(padding, 1, gap, file) == gap
+		  && (sizes[i] == 0 || fwrite(sections[i], 1, sizes[i], file) == sizes[i]);
+		written = header->offsets[i] + sizes[i];
+	}
+
+	const err_t error = ok ? 0 : errno != 0 ? errno : EIO;
+	if (fclose(file) != 0 && ok) return errno;
+	return error;
+}
+
+// Maps the whole file and checks that it is a compatible image of some kind.
+static err_t map_image(image_t *image, const char *path, enum image_kind kind,
+                       const struct image_header **header)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return errno;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		const err_t error = errno;
+		close(fd);
+		return error;
+	}
+	if ((size_t)info.st_size < sizeof(struct image_header)) {
+		close(fd);
+		return EINVAL;
+	}
+
+	void *address = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	const err_t error = address == MAP_FAILED ? errno : 0;
+	close(fd); // the mapping keeps its own reference to the file
+	if (error) return error;
+
+	image->address = address;
+	image->length = info.st_size;
+	*header = address;
+
+	struct image_header expected;
+	init_header(&expected, kind);
+	const bool compatible = memcmp((*header)->magic, MAGIC, sizeof(MAGIC)) == 0
+	                     && (*header)->version == expected.version
+	                     && (*header)->kind == expected.kind
+	                     && (*header)->byte_order == expected.byte_order
+	                     && (*header)->word_sizes == expected.word_sizes;
+	if (!compatible) {
+		image_close(image);
+		return EINVAL;
+	}
+	return 0;
+}
+
+// Checks that a section of N elements of some SIZE lies entirely inside the
+// image and is properly aligned, without ever computing an overflowing size.
+static bool section_fits(const image_t *image, uint64_t offset, uint64_t n, uint64_t size)
+{
+	if (offset > image->length || offset % SECTION_ALIGNMENT != 0) return false;
+	return size == 0 || n <= (image->length - offset) / size;
+}
+
+// Checks that every control byte is meaningful, agrees with the header's
+// counts and that there's at least one EMPTY bucket, or probing wouldn't stop.
+static bool ctrl_valid(const byte_t *ctrl, uint64_t n, uint64_t count, uint64_t filled)
+{
+	uint64_t full = 0, empty = 0;
+	for (uint64_t i = 0; i < n; ++i) {
+		if (probe_is_full(ctrl[i])) full++;
+		else if (ctrl[i] == PROBE_EMPTY) empty++;
+		else if (ctrl[i] != PROBE_DELETED) return false;
+	}
+	return full == count && n - empty == filled && empty > 0;
+}
+
+// Loaded containers can't allocate anything, nor free their borrowed memory.
+static void *image_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	return NULL;
+}
+
+err_t map_save(map_t *map, const char *path)
+{
+	// finish migrating any old buckets, so that there's a single table
+	const unsigned flags = map->flags;
+	if (map->old.capacity > 0) {
+		const err_t error = map_set_flags(map, flags & ~MAP_INCREMENTAL_REHASH);
+		if (error) return error;
+		map_set_flags(map, flags);
+	}
+
+	struct image_header header;
+	init_header(&header, IMAGE_MAP);
+	header.group_width = PROBE_GROUP_WIDTH;
+	header.flags = flags & ~MAP_INCREMENTAL_REHASH;
+	header.count = map->count;
+	header.filled = map->filled;
+	header.capacity = map->buckets.capacity;
+	header.key_size = map->key_size;
+	header.value_size = map->value_size;
+
+	const index_t n = map->buckets.capacity;
+	const void *sections[] = {
+		map->buckets.ctrl, map->buckets.hashes, map->buckets.keys, map->buckets.values,
+	};
+	const uint64_t sizes[] = {
+		n, n * sizeof(hash_t), n * map->key_size, n * map->value_size,
+	};
+	return write_image(path, &header, 4, sections, sizes);
+}
+
+err_t map_load(map_t *map, image_t *image, const char *path,
+               compare_fn_t key_cmp, hash_fn_t key_hash)
+{
+	assert(key_cmp != NULL);
+
+	const struct image_header *header;
+	err_t error = map_image(image, path, IMAGE_MAP, &header);
+	if (error) return error;
+
+	const uint64_t n = header->capacity;
+	const bool valid = header->group_width == PROBE_GROUP_WIDTH
+	                && n >= PROBE_GROUP_WIDTH && (n & (n - 1)) == 0
+	                && header->count <= header->filled && header->filled < n
+	                && header->key_size > 0
+	                && section_fits(image, header->offsets[0], n, 1)
+	                && section_fits(image, header->offsets[1], n, sizeof(hash_t))
+	                && section_fits(image, header->offsets[2], n, header->key_size)
+	                && section_fits(image, header->offsets[3], n, header->value_size)
+	                && ctrl_valid((const byte_t *)image->address + header->offsets[0],
+	                              n, header->count, header->filled);
+	if (!valid) {
+		image_close(image);
+		return EINVAL;
+	}
+
+	byte_t *base = image->address;
+	map->count = header->count;
+	map->filled = header->filled;
+	map->buckets = (struct map_buckets){
+		.capacity = n,
+		.ctrl = base + header->offsets[0],
+		.hashes = (hash_t *)(base + header->offsets[1]),
+		.keys = base + header->offsets[2],
+		.values = base + header->offsets[3],
+	};
+	map->old = (struct map_buckets){ .capacity = 0 };
+	map->migrated = 0;
+	map->flags = header->flags;
+#ifdef UGLY_MAP_STATS
+	map->stats = (struct map_stats){ .lookups = 0 };
+#endif
+	map->key_size = header->key_size;
+	map->value_size = header->value_size;
+	map->compare = key_cmp;
+	map->hash = key_hash != NULL ? key_hash // same defaults as map_init()
+	          : map->key_size == 4 ? hash_u32
+	          : map->key_size == 8 ? hash_u64
+	          : wyhash;
+	map->alloc = (struct allocator){ .method = image_alloc, .environment = image };
+	return 0;
+}
+
+err_t list_save(const list_t *list, const char *path)
+{
+	struct image_header header;
+	init_header(&header, IMAGE_LIST);
+	header.count = list->length;
+	header.key_size = list->elem_size;
+
+	const void *sections[] = { list->data };
+	const uint64_t sizes[] = { list->length * list->elem_size };
+	return write_image(path, &header, 1, sections, sizes);
+}
+
+err_t list_load(list_t *list, image_t *image, const char *path)
+{
+	const struct image_header *header;
+	err_t error = map_image(image, path, IMAGE_LIST, &header);
+	if (error) return error;
+
+	const bool valid = header->key_size > 0
+	                && section_fits(image, header->offsets[0], header->count, header->key_size);
+	if (!valid) {
+		image_close(image);
+		return EINVAL;
+	}
+
+	list->length = header->count;
+	list->capacity = header->count;
+	list->data = (byte_t *)image->address + header->offsets[0];
+	list->elem_size = header->key_size;
+	list->alloc = (struct allocator){ .method = image_alloc, .environment = image };
+	list->policy = LIST_DEFAULT_POLICY;
+	list->policy.shrink = false;
+	return 0;
+}
+
+void image_close(image_t *image)
+{
+	munmap(image->address, image->length);
+	image->address = NULL;
+	image->length = 0;
+}
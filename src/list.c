@@ -1,20 +1,39 @@
 #include "list.h"
 
 #include <assert.h>
-#include <string.h> // memcpy
-#include <stdlib.h> // bsearch, qsort
+#include <string.h> // memcpy, memmove, memset
 #include <errno.h>
 
 #include "core.h" // NULL, memswap, STDLIB_ALLOCATOR
+#include "search.h"
+#include "sort.h"
 
 
-#define RESIZE_FACTOR 1.618 // the golden ratio, just for fun
+// Capacity is shrunk when its usage drops below this ratio, see `list_set_policy()`.
+#define SHRINK_RATIO(FACTOR) ((1.0 / (FACTOR)) / 2.0)
 
-#define SHRINK_RATIO ((1.0 / RESIZE_FACTOR) / 2.0)
 
-#define MIN_NONZERO_SIZE 8
-static_assert(MIN_NONZERO_SIZE > 0, "MIN_NONZERO_SIZE must be positive");
+// Reallocates to (at least) the given capacity, which must hold every element.
+static err_t list_realloc(list_t *list, index_t capacity)
+{
+	assert(capacity >= list->length);
+	if (capacity == 0) {
+		if (list->data != NULL)
+			allocator_resize(&list->alloc, list->data, 0, list->policy.alignment, NULL);
+		list->data = NULL;
+		list->capacity = 0;
+		return 0;
+	}
 
+	// whatever slack the allocator gives us is extra capacity
+	size_t usable;
+	void *new = allocator_resize(&list->alloc, list->data, capacity * list->elem_size,
+	                             list->policy.alignment, &usable);
+	if (new == NULL) return ENOMEM;
+	list->capacity = usable / list->elem_size;
+	list->data = new;
+	return 0;
+}
 
 err_t list_init(list_t *list, index_t length, size_t type_size, struct allocator alloc)
 {
@@ -22,19 +41,41 @@ err_t list_init(list_t *list, index_t length, size_t type_size, struct allocator
 	assert(type_size > 0);
 
 	list->length = 0;
-	list->capacity = length;
+	list->capacity = 0;
+	list->data = NULL;
 	list->elem_size = type_size;
 
+	list->policy = LIST_DEFAULT_POLICY;
 	list->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR;
-	list->data = list->alloc.method(&list->alloc, NULL, length * list->elem_size);
-	if (list->data == NULL && length != 0) return ENOMEM;
-
-	return 0;
+	return list_realloc(list, length);
 }
 
 void list_destroy(list_t *list)
 {
-	list->alloc.method(&list->alloc, list->data, 0);
+	if (list->data == NULL) return;
+	allocator_resize(&list->alloc, list->data, 0, list->policy.alignment, NULL);
+}
+
+void list_set_policy(list_t *list, struct list_policy policy)
+{
+	assert(policy.growth_factor > 1.0);
+	assert(policy.min_capacity >= 0);
+	assert((policy.alignment & (policy.alignment - 1)) == 0);
+	assert(list->data == NULL || policy.alignment == list->policy.alignment);
+	list->policy = policy;
+}
+
+err_t list_reserve(list_t *list, index_t n)
+{
+	assert(n >= 0);
+	return n > list->capacity ? list_realloc(list, n) : 0;
+}
+
+err_t list_shrink_to_fit(list_t *list)
+{
+	const index_t capacity = list->length > list->policy.min_capacity
+	                       ? list->length : list->policy.min_capacity;
+	return capacity < list->capacity ? list_realloc(list, capacity) : 0;
 }
 
 index_t list_size(const list_t *list)
@@ -51,31 +92,28 @@ inline void *list_ref(const list_t *list, index_t index)
 	return list->data + index * list->elem_size;
 }
 
-static inline err_t list_grow(list_t *list)
+// Grows capacity geometrically until it can hold at least N elements.
+static inline err_t list_grow(list_t *list, index_t n)
 {
-	assert(RESIZE_FACTOR*MIN_NONZERO_SIZE > MIN_NONZERO_SIZE);
-	const index_t new_capacity = list->capacity >= MIN_NONZERO_SIZE ? list->capacity * RESIZE_FACTOR : MIN_NONZERO_SIZE;
-	void *new = list->alloc.method(&list->alloc, list->data, new_capacity * list->elem_size);
-	if (new == NULL) return ENOMEM;
-	list->capacity = new_capacity;
-	list->data = new;
-	return 0;
+	if (n <= list->capacity) return 0;
+	const struct list_policy *policy = &list->policy;
+	index_t new_capacity = list->capacity > policy->min_capacity
+	                     ? list->capacity : policy->min_capacity;
+	while (new_capacity < n) {
+		const index_t grown = new_capacity * policy->growth_factor;
+		new_capacity = grown > new_capacity ? grown : new_capacity + 1;
+	}
+	return list_realloc(list, new_capacity);
 }
 
 err_t list_append(list_t *list, const void *element)
 {
-	// grow current capacity in case its not enough
-	if (list->length + 1 > list->capacity) {
-		const err_t error = list_grow(list);
-		if (error) return error;
-	}
-
-	// append copy to the end of the list
-	byte_t *end = list->data + list->length * list->elem_size;
-	memcpy(end, element, list->elem_size);
-	list->length++;
+	return list_extend(list, 1, element);
+}
 
-	return 0;
+err_t list_extend(list_t *list, index_t n, const void *elements)
+{
+	return list_insert_range(list, list->length, n, elements);
 }
 
 inline void list_swap(list_t *list, index_t a, index_t b)
@@ -84,59 +122,112 @@ inline void list_swap(list_t *list, index_t a, index_t b)
 }
 
 err_t list_insert(list_t *list, index_t index, const void *element)
+{
+	return list_insert_range(list, index, 1, element);
+}
+
+err_t list_insert_range(list_t *list, index_t index, index_t n, const void *elements)
 {
 	assert(0 <= index);
 	assert(index <= list->length);
+	assert(n >= 0);
+	if (n == 0) return 0;
 
-	// append
-	const err_t error = list_append(list, element);
+	// grow current capacity in case its not enough
+	const err_t error = list_grow(list, list->length + n);
 	if (error) return error;
 
-	// swap backwards until inserted in the correct position
-	for (index_t i = list->length - 1; i > index; --i)
-		list_swap(list, i - 1, i);
+	// open a gap by moving the tail in a single pass, then fill it
+	byte_t *gap = list->data + index * list->elem_size;
+	memmove(gap + n * list->elem_size, gap, (list->length - index) * list->elem_size);
+	memcpy(gap, elements, n * list->elem_size);
+	list->length += n;
 
 	return 0;
 }
 
+// Shrinks capacity (possibly more than once) in case too much of it is unused.
 static inline void list_shrink(list_t *list)
 {
-	assert(SHRINK_RATIO > 0.0 && SHRINK_RATIO < 1.0/RESIZE_FACTOR);
-	const index_t new_capacity = list->capacity / RESIZE_FACTOR;
-	if (new_capacity < MIN_NONZERO_SIZE) return;
-	void *new = list->alloc.method(&list->alloc, list->data, new_capacity * list->elem_size);
-	assert(new != NULL); // shouldn't happen!
-	list->capacity = new_capacity;
-	list->data = new;
+	const struct list_policy *policy = &list->policy;
+	if (!policy->shrink) return;
+	const double ratio = SHRINK_RATIO(policy->growth_factor);
+	index_t new_capacity = list->capacity;
+	while (list->length < new_capacity * ratio
+	       && (index_t)(new_capacity / policy->growth_factor) >= policy->min_capacity
+	       && (index_t)(new_capacity / policy->growth_factor) > 0)
+		new_capacity = new_capacity / policy->growth_factor;
+	if (new_capacity == list->capacity) return;
+	const err_t error = list_realloc(list, new_capacity);
+	assert(!error); // shouldn't happen!
+	(void)error;
 }
 
 void list_remove(list_t *list, index_t index, void *restrict sink)
 {
-	assert(0 <= index);
-	assert(index < list->length);
+	list_remove_range(list, index, 1, sink);
+}
 
-	// send copy to output
-	const byte_t *source = list_ref(list, index);
-	memcpy(sink, source, list->elem_size);
+void list_remove_range(list_t *list, index_t index, index_t n, void *restrict sink)
+{
+	assert(0 <= index);
+	assert(n >= 0);
+	assert(index + n <= list->length);
+	if (n == 0) return;
 
-	// swap "removed" (free space) forward
-	for (index_t i = index; i < list->length - 1; ++i)
-		list_swap(list, i, i + 1);
+	// send copies to output
+	byte_t *gap = list->data + index * list->elem_size;
+	if (sink != NULL) memcpy(sink, gap, n * list->elem_size);
 
-	list->length--;
+	// close the gap by moving the tail in a single pass
+	const index_t tail = list->length - index - n;
+	memmove(gap, gap + n * list->elem_size, tail * list->elem_size);
+	list->length -= n;
 
 	// check if we should shrink capacity and do so if needed
-	if (list->length < list->capacity * SHRINK_RATIO)
+	list_shrink(list);
+}
+
+err_t list_resize(list_t *list, index_t length)
+{
+	assert(length >= 0);
+
+	if (length <= list->length) {
+		list->length = length;
 		list_shrink(list);
+		return 0;
+	}
+
+	const err_t error = list_grow(list, length);
+	if (error) return error;
+	memset(list->data + list->length * list->elem_size, 0,
+	       (length - list->length) * list->elem_size);
+	list->length = length;
+	return 0;
 }
 
 index_t list_search(const list_t *lst, const void *key, compare_fn_t cmp)
 {
-	const byte_t *p = bsearch(key, lst->data, lst->length, lst->elem_size, cmp);
-	return p == NULL ? -1 : (p - lst->data) / lst->elem_size;
+	const index_t i = list_lower_bound(lst, key, cmp);
+	return i < lst->length && cmp(key, lst->data + i * lst->elem_size) == 0 ? i : -1;
+}
+
+index_t list_lower_bound(const list_t *list, const void *key, compare_fn_t compare)
+{
+	return search_lower_bound(list->data, list->length, list->elem_size, key, compare);
 }
 
 void list_sort(list_t *list, compare_fn_t compare)
 {
-	qsort(list->data, list->length, list->elem_size, compare);
+	sort_intro(list->data, list->length, list->elem_size, compare);
+}
+
+err_t list_stable_sort(list_t *list, compare_fn_t compare)
+{
+	return sort_merge(list->data, list->length, list->elem_size, compare, list->alloc);
+}
+
+err_t list_radix_sort(list_t *list, sort_key_fn_t key, unsigned key_bits)
+{
+	return sort_radix(list->data, list->length, list->elem_size, key, key_bits, list->alloc);
 }
@@ -5,41 +5,103 @@
  * We chose to use closed hashing: no linked lists, reprobe on collision. Also,
  * this means pointers into the map are not stable, so prefer to hold keys.
  *
- * Entries are stored in two parallel arrays: one for keys, another for values.
- * This was chosen since no operation dereferences the value array, that's up
- * to the user. Therefore we should get better locality by only touching keys.
- * Probing method is linear, with an extra jump on the 1st collision.
+ * Entries are stored in four parallel arrays: one byte of control metadata per
+ * bucket, the full hash of each key, then one for keys and another for values.
+ * Caching hashes means growing the table never calls the hash function again,
+ * and probing rejects most tag collisions before comparing keys. By default,
+ * buckets are probed in SIMD-matched groups of control bytes (see probe.h), so
+ * we only touch keys (and call the comparison function) on likely hits.
+ * When tombstones make up most of the table's load, it is rebuilt at the same
+ * capacity instead of growing.
+ *
+ * In Robin Hood mode, buckets are probed linearly instead and entries are kept
+ * sorted by their home position, so a lookup may stop as soon as it reaches an
+ * entry closer to its own home than the key being searched for. Removals then
+ * shift the following entries back, which means no tombstones and a smaller
+ * variance in probe lengths, allowing for a higher maximum load factor.
+ *
+ * In incremental rehash mode, growing the table doesn't move any entries right
+ * away: the old buckets are kept alongside the new ones and every mutation then
+ * migrates a bounded number of them. Until that's done, lookups check both.
  */
 
 #include "map.h"
 
 #include <assert.h>
-#include <string.h> // memcpy
+#include <string.h> // memcpy, memset
 #include <errno.h>
-#include <stdalign.h> // alignas
+#include <stdint.h> // uint64_t
 
 #include "core.h" // byte_t, bool, stdlib_alloc
-#include "hash.h" // fnv_1a
+#include "hash.h" // wyhash, hash_u32, hash_u64
+#include "probe.h"
+
+// Robin Hood probing keeps probe lengths short even on fuller tables.
+#define ROBIN_HOOD_MAX_LOAD_FACTOR 0.9
 
+// How many old buckets are migrated by each mutation during an incremental rehash.
+#define MIGRATION_STEP 64
 
-// Ideally, this would be tuned based on hash function and usual keys.
-#define MAX_LOAD_FACTOR 0.75
+// How many keys are hashed and prefetched ahead of their probes in bulk operations.
+#define BATCH_SIZE 16
 
-struct map_entry {
-	bool in_use;
-	bool is_tombstone;
-	alignas(max_align_t) byte_t key[];
-};
+// Bucket arrays at least this big start at cache line boundaries, when the allocator can do it.
+#define BUCKET_ALIGNMENT 64
 
+#if defined(__GNUC__)
+#	define PREFETCH(ADDR) __builtin_prefetch(ADDR)
+#else
+#	define PREFETCH(ADDR) ((void)(ADDR))
+#endif
 
-static void clear_entries(byte_t *entries, index_t n, size_t size)
+// Stats are updated even by const operations, as they aren't part of the map's contents.
+static inline void record_probe(const map_t *map, index_t length)
 {
-	const byte_t *end = entries + n * size;
-	for (; entries < end; entries += size) {
-		struct map_entry *entry = (struct map_entry *)entries;
-		entry->in_use = false;
-		entry->is_tombstone = false;
-	}
+#ifdef UGLY_MAP_STATS
+	struct map_stats *stats = &((map_t *)map)->stats;
+	stats->probes += length;
+	if (length > stats->max_probe) stats->max_probe = length;
+#endif
+}
+
+static inline void record_lookup(const map_t *map, bool hit)
+{
+#ifdef UGLY_MAP_STATS
+	struct map_stats *stats = &((map_t *)map)->stats;
+	stats->lookups++;
+	if (hit) stats->hits++;
+	else stats->misses++;
+#endif
+}
+
+static inline void record_rehash(map_t *map)
+{
+#ifdef UGLY_MAP_STATS
+	map->stats.rehashes++;
+#endif
+}
+
+static inline double max_load_factor(const map_t *map)
+{
+	return map->flags & MAP_ROBIN_HOOD ? ROBIN_HOOD_MAX_LOAD_FACTOR : PROBE_MAX_LOAD_FACTOR;
+}
+
+// How far from its home position the (full) bucket at a given index is.
+static inline index_t home_distance(const struct map_buckets *b, index_t index)
+{
+	const index_t mask = b->capacity - 1;
+	const index_t home = probe_home(probe_mix(b->hashes[index])) & mask;
+	return (index - home) & mask;
+}
+
+static inline void copy_bucket(const map_t *map, struct map_buckets *b,
+                               index_t dest, index_t src)
+{
+	b->ctrl[dest] = b->ctrl[src];
+	b->hashes[dest] = b->hashes[src];
+	memcpy(b->keys + dest * map->key_size, b->keys + src * map->key_size, map->key_size);
+	byte_t *values = b->values;
+	memcpy(values + dest * map->value_size, values + src * map->value_size, map->value_size);
 }
 
 // Finds the nearest power of 2 equal or greater than x.
@@ -54,6 +116,53 @@ static unsigned nearest_pow2(int x)
 	return power;
 }
 
+// Cache line alignment is just a nice-to-have, so we fall back to the default one.
+static inline void *alloc_array(map_t *map, size_t size)
+{
+	if (map->alloc.extended != NULL && size >= BUCKET_ALIGNMENT) {
+		void *array = allocator_resize(&map->alloc, NULL, size, BUCKET_ALIGNMENT, NULL);
+		if (array != NULL) return array;
+	}
+	return map->alloc.method(&map->alloc, NULL, size);
+}
+
+static err_t alloc_buckets(map_t *map, struct map_buckets *b, index_t n)
+{
+	b->ctrl = alloc_array(map, n);
+	if (b->ctrl == NULL) return ENOMEM;
+	b->hashes = alloc_array(map, n * sizeof(hash_t));
+	if (b->hashes == NULL) {
+		map->alloc.method(&map->alloc, b->ctrl, 0);
+		return ENOMEM;
+	}
+	b->keys = alloc_array(map, n * map->key_size);
+	if (b->keys == NULL) {
+		map->alloc.method(&map->alloc, b->hashes, 0);
+		map->alloc.method(&map->alloc, b->ctrl, 0);
+		return ENOMEM;
+	}
+	b->values = alloc_array(map, n * map->value_size);
+	if (b->values == NULL && map->value_size != 0) {
+		map->alloc.method(&map->alloc, b->keys, 0);
+		map->alloc.method(&map->alloc, b->hashes, 0);
+		map->alloc.method(&map->alloc, b->ctrl, 0);
+		return ENOMEM;
+	}
+
+	memset(b->ctrl, PROBE_EMPTY, n);
+	b->capacity = n;
+	return 0;
+}
+
+static void free_buckets(map_t *map, struct map_buckets *b)
+{
+	map->alloc.method(&map->alloc, b->ctrl, 0);
+	map->alloc.method(&map->alloc, b->hashes, 0);
+	map->alloc.method(&map->alloc, b->keys, 0);
+	map->alloc.method(&map->alloc, b->values, 0);
+	*b = (struct map_buckets){ .capacity = 0 };
+}
+
 err_t map_init(map_t *map, index_t n, size_t key_size, size_t value_size,
                compare_fn_t key_cmp, hash_fn_t key_hash, struct allocator alloc)
 {
@@ -63,34 +172,33 @@ err_t map_init(map_t *map, index_t n, size_t key_size, size_t value_size,
 	assert(key_cmp != NULL);
 
 	/// adjust initial capacity by load factor and round up to nearest power of 2
-	n = nearest_pow2(n / MAX_LOAD_FACTOR);
+	n = nearest_pow2(n / PROBE_MAX_LOAD_FACTOR);
+	if (n < PROBE_GROUP_WIDTH) n = PROBE_GROUP_WIDTH;
 
 	map->count = 0;
 	map->filled = 0;
-	map->capacity = n;
+	map->old = (struct map_buckets){ .capacity = 0 };
+	map->migrated = 0;
+	map->flags = 0;
+#ifdef UGLY_MAP_STATS
+	map->stats = (struct map_stats){ .lookups = 0 };
+#endif
 	map->key_size = key_size;
 	map->value_size = value_size;
 	map->compare = key_cmp;
-	map->hash = key_hash != NULL ? key_hash : fnv_1a;
+	map->hash = key_hash != NULL ? key_hash
+	          : key_size == 4 ? hash_u32
+	          : key_size == 8 ? hash_u64
+	          : wyhash;
 
 	map->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR;
-	const size_t entry_size = sizeof(struct map_entry) + key_size;
-	map->keys = map->alloc.method(&map->alloc, NULL, n * entry_size);
-	if (map->keys == NULL && n != 0) return ENOMEM;
-	map->values = map->alloc.method(&map->alloc, NULL, n * value_size);
-	if (map->values == NULL && n != 0 && value_size != 0) {
-		map->alloc.method(&map->alloc, map->keys, 0);
-		return ENOMEM;
-	}
-
-	clear_entries(map->keys, n, entry_size);
-	return 0;
+	return alloc_buckets(map, &map->buckets, n);
 }
 
 void map_destroy(map_t *map)
 {
-	map->alloc.method(&map->alloc, map->keys, 0);
-	map->alloc.method(&map->alloc, map->values, 0);
+	free_buckets(map, &map->buckets);
+	if (map->old.capacity > 0) free_buckets(map, &map->old);
 }
 
 index_t map_size(const map_t *map)
@@ -100,142 +208,438 @@ index_t map_size(const map_t *map)
 
 extern inline bool map_empty(const map_t *map);
 
-static index_t find_entry(const map_t *map, const byte_t *keys, size_t n,
-                          const void *key)
+static index_t find_entry_robin_hood(const map_t *map, const struct map_buckets *b,
+                                     hash_t hash, const void *key)
 {
-	// this procedure does not loop infinitely because there will always be
-	// at least some unused buckets due to a maximum load factor smaller than 1
-	assert(MAX_LOAD_FACTOR > 0.0 && MAX_LOAD_FACTOR < 1.0);
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-
-	// N must be a power of 2, so we can swap modulo operations for bitmasks
-	assert((n & (n-1)) == 0);
-	const size_t mask = n - 1;
-
-	// step 1: start at index hash(key) % n, check for a hit or free slot
-	const hash_t hash = map->hash(key, map->key_size);
-	index_t index = hash & mask;
-	struct map_entry *entry = (struct map_entry *)(keys + index * entry_size);
-	if (entry->in_use && map->compare(key, entry->key) == 0) return index;
-	else if (!entry->in_use && !entry->is_tombstone) return index;
-
-	// step 2: collision detected, use the upper hash bits to jump elsewhere
-	index = (index + (hash >> 16)) & mask;
-
-	// step 3: now do the linear probing, looking for tombstones along the way
-	for (index_t tombstone = -1; true; index = (index + 1) & mask) {
-		entry = (struct map_entry *)(keys + index * entry_size);
-		if (!entry->in_use) {
-			if (entry->is_tombstone && tombstone < 0)
-				tombstone = index; // save first tombstone, but keep going
-			else if (!entry->is_tombstone)
-				return tombstone >= 0 ? tombstone : index; // tombstone has priority
-		} else if (map->compare(key, entry->key) == 0) {
+	const index_t mask = b->capacity - 1;
+	const uint64_t mixed = probe_mix(hash);
+	const byte_t tag = probe_tag(mixed);
+
+	index_t index = probe_home(mixed) & mask;
+	index_t distance = 0;
+	for (; true; ++distance, index = (index + 1) & mask) {
+		const byte_t ctrl = b->ctrl[index];
+		if (ctrl == PROBE_EMPTY) break;
+		else if (ctrl == PROBE_DELETED) continue; // only left behind by migrations
+
+		// had the key been inserted, it would have displaced this entry
+		if (home_distance(b, index) < distance) break;
+
+		if (ctrl != tag || b->hashes[index] != hash) continue;
+		if (map->compare(key, b->keys + index * map->key_size) == 0) {
+			record_probe(map, distance + 1);
 			return index;
 		}
 	}
+	record_probe(map, distance + 1);
+	return -1;
+}
+
+static index_t find_entry(const map_t *map, const struct map_buckets *b,
+                          hash_t hash, const void *key)
+{
+	if (map->flags & MAP_ROBIN_HOOD) return find_entry_robin_hood(map, b, hash, key);
+
+	// N must be a power of 2 (and a multiple of the group width), so we can
+	// swap modulo operations for bitmasks
+	const index_t n = b->capacity;
+	assert((n & (n-1)) == 0 && n >= PROBE_GROUP_WIDTH);
+	const index_t mask = n - 1;
+
+	const uint64_t mixed = probe_mix(hash);
+	const byte_t tag = probe_tag(mixed);
+
+	// this procedure does not loop infinitely because there will always be
+	// at least some empty buckets due to a maximum load factor smaller than 1
+	assert(PROBE_MAX_LOAD_FACTOR > 0.0 && PROBE_MAX_LOAD_FACTOR < 1.0);
+	assert(ROBIN_HOOD_MAX_LOAD_FACTOR > 0.0 && ROBIN_HOOD_MAX_LOAD_FACTOR < 1.0);
+	index_t group = probe_start(mixed, mask);
+	for (index_t stride = PROBE_GROUP_WIDTH; true; stride += PROBE_GROUP_WIDTH) {
+		const byte_t *ctrl = b->ctrl + group;
+
+		// only compare keys whose tags and then full hashes match
+		for (probe_mask_t hits = probe_match(ctrl, tag); hits; hits &= hits - 1) {
+			const index_t index = group + probe_lowest_bit(hits);
+			if (b->hashes[index] != hash) continue;
+			if (map->compare(key, b->keys + index * map->key_size) == 0) {
+				record_probe(map, stride / PROBE_GROUP_WIDTH);
+				return index;
+			}
+		}
+
+		// an empty bucket means probing for this key would have stopped here
+		if (probe_match(ctrl, PROBE_EMPTY)) {
+			record_probe(map, stride / PROBE_GROUP_WIDTH);
+			return -1;
+		}
+
+		group = (group + stride) & mask;
+	}
+}
+
+/**
+ * Finds where a new entry (known not to be in the table) with the given hash
+ * should go. In Robin Hood mode, entries at and after that place will have
+ * been shifted forward, leaving an EMPTY bucket there.
+ */
+static index_t place_entry(const map_t *map, struct map_buckets *b, hash_t hash)
+{
+	const uint64_t mixed = probe_mix(hash);
+	if (!(map->flags & MAP_ROBIN_HOOD)) return probe_find_vacant(b->ctrl, b->capacity, mixed);
+
+	// skip entries which are at least as far from home as the new one would be
+	const index_t mask = b->capacity - 1;
+	index_t index = probe_home(mixed) & mask;
+	for (index_t distance = 0; true; ++distance, index = (index + 1) & mask) {
+		assert(b->ctrl[index] != PROBE_DELETED);
+		if (b->ctrl[index] == PROBE_EMPTY || home_distance(b, index) < distance) break;
+	}
+
+	// then shift the rest of the cluster by one, starting from its end
+	index_t end = index;
+	while (b->ctrl[end] != PROBE_EMPTY) end = (end + 1) & mask;
+	for (; end != index; end = (end - 1) & mask) copy_bucket(map, b, end, (end - 1) & mask);
+	b->ctrl[index] = PROBE_EMPTY;
+	return index;
+}
+
+// Removes a bucket's entry, leaving a tombstone behind only when needed.
+static void erase_entry(map_t *map, struct map_buckets *b, index_t k)
+{
+	const bool is_current = b == &map->buckets;
+
+	// Robin Hood tables shift later entries back, until one is already at home
+	if (map->flags & MAP_ROBIN_HOOD) {
+		if (!is_current) { // except during migrations, see find_entry_robin_hood
+			b->ctrl[k] = PROBE_DELETED;
+			return;
+		}
+		const index_t mask = b->capacity - 1;
+		for (index_t next = (k + 1) & mask; true; k = next, next = (next + 1) & mask) {
+			if (!probe_is_full(b->ctrl[next]) || home_distance(b, next) == 0) break;
+			copy_bucket(map, b, k, next);
+		}
+		b->ctrl[k] = PROBE_EMPTY;
+		map->filled--;
+		return;
+	}
+
+	// we need to mark the deleted entry as a tombsone to enable probing,
+	// but only if some probe sequence could have passed through its group
+	if (probe_erase(b->ctrl, k) && is_current) map->filled--;
+}
+
+// Looks a key up in the current buckets, then in the old ones while migrating.
+static void *find_value(const map_t *map, hash_t hash, const void *key)
+{
+	void *value = NULL;
+	index_t k = find_entry(map, &map->buckets, hash, key);
+	if (k >= 0) {
+		value = map->buckets.values + k * map->value_size;
+	} else if (map->old.capacity > 0) {
+		k = find_entry(map, &map->old, hash, key);
+		if (k >= 0) value = map->old.values + k * map->value_size;
+	}
+	record_lookup(map, value != NULL);
+	return value;
 }
 
 void *map_get(const map_t *map, const void *key)
 {
 	if (map->count <= 0) return NULL;
-	const index_t k = find_entry(map, map->keys, map->capacity, key);
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-	struct map_entry *entry = (struct map_entry *)(map->keys + k * entry_size);
-	return entry->in_use ? map->values + k * map->value_size : NULL;
+	return find_value(map, map->hash(key, map->key_size), key);
 }
 
-static err_t rehash_table(map_t *map, index_t n)
+void *map_get_hashed(const map_t *map, const void *key, hash_t hash)
 {
-	// initialize and clear a new bucket array with the desired capacity
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-	byte_t *new_keys = map->alloc.method(&map->alloc, NULL, n * entry_size);
-	if (new_keys == NULL) return ENOMEM;
-	byte_t *new_values = map->alloc.method(&map->alloc, NULL, n * map->value_size);
-	if (new_values == NULL && map->value_size != 0) {
-		map->alloc.method(&map->alloc, new_keys, 0);
-		return ENOMEM;
+	if (map->count <= 0) return NULL;
+	return find_value(map, hash, key);
+}
+
+// Hashes a batch of keys and prefetches the buckets they'll most likely hit.
+static void prefetch_batch(const map_t *map, const byte_t *keys, index_t n,
+                           hash_t hashes[BATCH_SIZE])
+{
+	assert(n <= BATCH_SIZE);
+	const struct map_buckets *b = &map->buckets;
+	const index_t mask = b->capacity - 1;
+	for (index_t i = 0; i < n; ++i) {
+		hashes[i] = map->hash(keys + i * map->key_size, map->key_size);
+		const index_t position = probe_home(probe_mix(hashes[i])) & mask;
+		const index_t group = position & ~(index_t)(PROBE_GROUP_WIDTH - 1);
+		PREFETCH(b->ctrl + group);
+		PREFETCH(b->hashes + position);
+		PREFETCH(b->keys + position * map->key_size);
+		PREFETCH(b->values + position * map->value_size);
 	}
-	clear_entries(new_keys, n, entry_size);
+}
 
-	// copy every old entry to a newly-computed place in the rehashed table
-	map->filled = 0;
-	for (index_t i = 0; i < map->capacity; ++i) {
-		struct map_entry *src = (struct map_entry *)(map->keys + i * entry_size);
-		if (!src->in_use) continue;
-		const index_t k = find_entry(map, new_keys, n, src->key);
-		struct map_entry *dest = (struct map_entry *)(new_keys + k * entry_size);
-		memcpy(dest, src, entry_size);
-		byte_t *old_value = map->values + i * map->value_size;
-		byte_t *new_value = new_values + k * map->value_size;
-		memcpy(new_value, old_value, map->value_size);
+index_t map_get_many(const map_t *map, index_t n, const void *keys, void **values)
+{
+	assert(n >= 0);
+	if (map->count <= 0) {
+		for (index_t i = 0; i < n; ++i) values[i] = NULL;
+		return 0;
+	}
+
+	index_t found = 0;
+	const byte_t *batch = keys;
+	for (index_t done = 0; done < n; done += BATCH_SIZE) {
+		const index_t m = n - done < BATCH_SIZE ? n - done : BATCH_SIZE;
+		hash_t hashes[BATCH_SIZE];
+		prefetch_batch(map, batch, m, hashes);
+
+		// by now, (some of) the buckets should be on their way to the cache
+		for (index_t i = 0; i < m; ++i) {
+			values[done + i] = find_value(map, hashes[i], batch + i * map->key_size);
+			found += values[done + i] != NULL;
+		}
+
+		batch += m * map->key_size;
+	}
+	return found;
+}
+
+// Moves an entry to a place, computed from its cached hash, in DEST.
+static void move_entry(map_t *map, struct map_buckets *dest,
+                       const struct map_buckets *src, index_t i)
+{
+	const index_t k = place_entry(map, dest, src->hashes[i]);
+	dest->ctrl[k] = src->ctrl[i];
+	dest->hashes[k] = src->hashes[i];
+	memcpy(dest->keys + k * map->key_size, src->keys + i * map->key_size, map->key_size);
+	byte_t *old_value = src->values + i * map->value_size;
+	byte_t *new_value = dest->values + k * map->value_size;
+	memcpy(new_value, old_value, map->value_size);
+}
+
+// Migrates up to N old buckets into the current ones, freeing them when done.
+static void migrate_buckets(map_t *map, index_t n)
+{
+	struct map_buckets *old = &map->old;
+	const index_t end = map->migrated + n < old->capacity ? map->migrated + n : old->capacity;
+	for (index_t i = map->migrated; i < end; ++i) {
+		if (!probe_is_full(old->ctrl[i])) continue;
+		move_entry(map, &map->buckets, old, i);
+		old->ctrl[i] = PROBE_DELETED; // keeps probe sequences of the other old entries
 		map->filled++;
 	}
+	map->migrated = end;
+	if (map->migrated >= old->capacity) free_buckets(map, old);
+}
 
-	// update table's bucket list (remember to free the old one)
-	map->capacity = n;
-	map->alloc.method(&map->alloc, map->keys, 0);
-	map->alloc.method(&map->alloc, map->values, 0);
-	map->keys = new_keys;
-	map->values = new_values;
+static err_t rehash_table(map_t *map, index_t n)
+{
+	// any pending migration must be done before we start another
+	if (map->old.capacity > 0) migrate_buckets(map, map->old.capacity);
+
+	// initialize and clear a new bucket array with the desired capacity
+	struct map_buckets new_buckets;
+	const err_t error = alloc_buckets(map, &new_buckets, n);
+	if (error) return error;
+	record_rehash(map);
+
+	// in incremental mode, entries are only moved by later mutations
+	map->filled = 0;
+	map->old = map->buckets;
+	map->buckets = new_buckets;
+	map->migrated = 0;
+	if (map->flags & MAP_INCREMENTAL_REHASH) return 0;
+
+	// otherwise, copy every old entry to the rehashed table right away
+	migrate_buckets(map, map->old.capacity);
 	return 0;
 }
 
-err_t map_insert(map_t *map, const void *key, const void *value)
+// Finds the value slot of an entry, creating it (with an uninitialized value) if needed.
+static void *emplace_entry(map_t *map, hash_t hash, const void *key, bool *created)
 {
-	/// check if the table's capacity needs to grow to reduce its load factor
-	if (map->filled + 1 > map->capacity * MAX_LOAD_FACTOR) {
-		const index_t new_capacity = map->capacity > 0 ? map->capacity * 2 : 8;
-		const err_t error = rehash_table(map, new_capacity);
-		if (error) return error;
+	if (map->old.capacity > 0) migrate_buckets(map, MIGRATION_STEP);
+
+	// existing entries are left untouched
+	void *existing = find_value(map, hash, key);
+	*created = existing == NULL;
+	if (existing != NULL) return existing;
+
+	/// check if the table's capacity needs to grow to reduce its load factor,
+	/// unless enough of its load is due to tombstones, which a rehash purges
+	struct map_buckets *b = &map->buckets;
+	if (map->filled + 1 > b->capacity * max_load_factor(map)) {
+		const bool purge = map->old.capacity <= 0
+		                && map->count <= b->capacity * PROBE_PURGE_LOAD_FACTOR;
+		const err_t error = rehash_table(map, purge ? b->capacity : b->capacity * 2);
+		if (error) return NULL;
 	}
 
 	// finds entry address; should be done after rehashing (if it happens)
-	const index_t k = find_entry(map, map->keys, map->capacity, key);
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-	struct map_entry *entry = (struct map_entry *)(map->keys + k * entry_size);
+	const index_t k = place_entry(map, b, hash);
 
-	// if entry was vacant, increase hashtable's load
-	const bool was_vacant = !entry->in_use;
-	if (was_vacant) {
-		entry->in_use = true;
-		map->count++;
-		if (!entry->is_tombstone) map->filled++;
-	}
+	// if entry wasn't a tombstone, increase hashtable's load
+	if (b->ctrl[k] == PROBE_EMPTY) map->filled++;
+	b->ctrl[k] = probe_tag(probe_mix(hash));
+	b->hashes[k] = hash;
+	map->count++;
 
-	// copy key and value pair
-	memcpy(entry->key, key, map->key_size);
-	memcpy(map->values + k * map->value_size, value, map->value_size);
-	return was_vacant ? 0 : -1;
+	// copy key, the value is up to the caller
+	memcpy(b->keys + k * map->key_size, key, map->key_size);
+	return b->values + k * map->value_size;
+}
+
+static err_t insert_entry(map_t *map, hash_t hash, const void *key, const void *value)
+{
+	bool created;
+	void *slot = emplace_entry(map, hash, key, &created);
+	if (slot == NULL) return ENOMEM;
+	memcpy(slot, value, map->value_size);
+	return created ? 0 : -1;
+}
+
+err_t map_insert(map_t *map, const void *key, const void *value)
+{
+	return insert_entry(map, map->hash(key, map->key_size), key, value);
+}
+
+err_t map_insert_hashed(map_t *map, const void *key, hash_t hash, const void *value)
+{
+	return insert_entry(map, hash, key, value);
+}
+
+void *map_upsert(map_t *map, const void *key, bool *created)
+{
+	return emplace_entry(map, map->hash(key, map->key_size), key, created);
+}
+
+void *map_upsert_hashed(map_t *map, const void *key, hash_t hash, bool *created)
+{
+	return emplace_entry(map, hash, key, created);
+}
+
+err_t map_insert_many(map_t *map, index_t n, const void *keys, const void *values)
+{
+	assert(n >= 0);
+	const byte_t *key_batch = keys;
+	const byte_t *value_batch = values;
+	for (index_t done = 0; done < n; done += BATCH_SIZE) {
+		const index_t m = n - done < BATCH_SIZE ? n - done : BATCH_SIZE;
+		hash_t hashes[BATCH_SIZE];
+		prefetch_batch(map, key_batch, m, hashes);
+
+		for (index_t i = 0; i < m; ++i) {
+			const void *key = key_batch + i * map->key_size;
+			const void *value = value_batch + i * map->value_size;
+			const err_t error = insert_entry(map, hashes[i], key, value);
+			if (error > 0) return error;
+		}
+
+		key_batch += m * map->key_size;
+		value_batch += m * map->value_size;
+	}
+	return 0;
 }
 
 err_t map_remove(map_t *map, const void *key)
 {
 	if (map->count <= 0) return ENOKEY;
+	return map_remove_hashed(map, key, map->hash(key, map->key_size));
+}
 
-	const index_t k = find_entry(map, map->keys, map->capacity, key);
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-	struct map_entry *entry = (struct map_entry *)(map->keys + k * entry_size);
-	if (!entry->in_use) return ENOKEY;
+err_t map_remove_hashed(map_t *map, const void *key, hash_t hash)
+{
+	if (map->count <= 0) return ENOKEY;
+	if (map->old.capacity > 0) migrate_buckets(map, MIGRATION_STEP);
+
+	// the entry may be in either bucket array during a migration
+	struct map_buckets *b = &map->buckets;
+	index_t k = find_entry(map, b, hash, key);
+	if (k < 0 && map->old.capacity > 0) {
+		b = &map->old;
+		k = find_entry(map, b, hash, key);
+	}
+	record_lookup(map, k >= 0);
+	if (k < 0) return ENOKEY;
 
-	// we need to mark the deleted entry as a tombsone to enable probing
-	entry->in_use = false;
-	entry->is_tombstone = true;
+	erase_entry(map, b, k);
 	map->count--;
 
 	return 0;
 }
 
-err_t map_for_each(const map_t *map,
-                   err_t (*proc)(const void *k, void *v, void *fwd), void *forward)
+err_t map_compact(map_t *map)
+{
+	index_t n = nearest_pow2(map->count / max_load_factor(map));
+	if (n < PROBE_GROUP_WIDTH) n = PROBE_GROUP_WIDTH;
+
+	// compaction is not incremental, since its whole point is freeing memory
+	const unsigned flags = map->flags;
+	map->flags &= ~MAP_INCREMENTAL_REHASH;
+	const err_t error = rehash_table(map, n);
+	map->flags = flags;
+	return error;
+}
+
+err_t map_set_flags(map_t *map, unsigned flags)
+{
+	// leaving incremental mode means finishing any pending migration
+	if (!(flags & MAP_INCREMENTAL_REHASH) && map->old.capacity > 0)
+		migrate_buckets(map, map->old.capacity);
+
+	// changing the probing scheme means placing every entry again
+	const unsigned old_flags = map->flags;
+	const bool reprobe = (flags ^ old_flags) & MAP_ROBIN_HOOD;
+	if (!reprobe) {
+		map->flags = flags;
+		return 0;
+	}
+
+	// so we rebuild the table (using the old scheme to find pending entries)
+	if (map->old.capacity > 0) migrate_buckets(map, map->old.capacity);
+	map->flags = flags & ~MAP_INCREMENTAL_REHASH;
+	index_t n = map->buckets.capacity;
+	while (map->count > n * max_load_factor(map)) n *= 2;
+	const err_t error = rehash_table(map, n);
+	map->flags = error ? old_flags : flags;
+	return error;
+}
+
+static err_t for_each_in(const map_t *map, const struct map_buckets *b,
+                         err_t (*proc)(const void *k, void *v, void *fwd), void *forward)
 {
 	err_t err = 0;
-	const size_t entry_size = sizeof(struct map_entry) + map->key_size;
-	for (index_t i = 0; i < map->capacity; ++i) {
-		struct map_entry *e = (struct map_entry *)(map->keys + i * entry_size);
-		if (!e->in_use) continue;
-		err = proc(e->key, map->values + i * map->value_size, forward);
+	for (index_t i = 0; i < b->capacity; ++i) {
+		if (!probe_is_full(b->ctrl[i])) continue;
+		err = proc(b->keys + i * map->key_size, b->values + i * map->value_size, forward);
 		if (err) break;
 	}
 	return err;
 }
+
+err_t map_for_each(const map_t *map,
+                   err_t (*proc)(const void *k, void *v, void *fwd), void *forward)
+{
+	const err_t err = for_each_in(map, &map->buckets, proc, forward);
+	if (err || map->old.capacity <= 0) return err;
+	return for_each_in(map, &map->old, proc, forward);
+}
+
+static index_t count_tombstones(const struct map_buckets *b)
+{
+	index_t tombstones = 0;
+	for (index_t i = 0; i < b->capacity; ++i) tombstones += b->ctrl[i] == PROBE_DELETED;
+	return tombstones;
+}
+
+struct map_stats map_stats(const map_t *map)
+{
+#ifdef UGLY_MAP_STATS
+	struct map_stats stats = map->stats;
+#else
+	struct map_stats stats = { .lookups = 0 };
+#endif
+
+	// these are cheap enough to compute when asked for
+	const size_t bucket_size = 1 + sizeof(hash_t) + map->key_size + map->value_size;
+	stats.bytes = (map->buckets.capacity + map->old.capacity) * bucket_size;
+	stats.tombstones = count_tombstones(&map->buckets);
+	if (map->old.capacity > 0) stats.tombstones += count_tombstones(&map->old);
+	return stats;
+}
@@ -0,0 +1,333 @@
+/**
+ * @file parallel.c
+ *
+ * Every algorithm here is phrased as a number of independent tasks, which a
+ * pool of threads (created for each call and joined before it returns) pulls
+ * from a shared atomic counter. Having a few more tasks than threads evens out
+ * chunks which take longer than others.
+ *
+ * The parallel sort first sorts one chunk per thread, then merges pairs of
+ * sorted runs until there's only one. Each merge is split into as many
+ * segments as there are threads by binary searching where each segment's
+ * output begins in both runs, so even the final merge uses every thread.
+ */
+
+#define _POSIX_C_SOURCE 200809L // sysconf
+
+#include "parallel.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h> // sysconf
+
+#include "core.h" // byte_t
+#include "list.h"
+#include "sort.h" // sort_intro, sort_merge_arrays
+
+// Lists are split into about this many chunks per thread.
+#define CHUNKS_PER_THREAD 4
+
+// Chunks smaller than this (in elements) aren't worth a thread of their own.
+#define MIN_CHUNK 4096
+
+
+struct job {
+	void (*run)(void *context, index_t task);
+	void *context;
+	index_t tasks;
+	atomic_long next;
+};
+
+static void *work(void *arg)
+{
+	struct job *job = arg;
+	for (;;) {
+		const index_t task = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+		if (task >= job->tasks) return NULL;
+		job->run(job->context, task);
+	}
+}
+
+// Runs every task on up to THREADS threads, including the calling one.
+static void run_tasks(unsigned threads, index_t tasks, struct allocator alloc,
+                      void (*run)(void *context, index_t task), void *context)
+{
+	struct job job = { .run = run, .context = context, .tasks = tasks };
+	atomic_init(&job.next, 0);
+	if (threads > tasks) threads = tasks;
+
+	pthread_t *workers = NULL;
+	unsigned spawned = 0;
+	if (threads > 1) {
+		workers = alloc.method(&alloc, NULL, (threads - 1) * sizeof(pthread_t));
+		if (workers != NULL) {
+			while (spawned < threads - 1
+			       && pthread_create(&workers[spawned], NULL, work, &job) == 0)
+				spawned++;
+		}
+	}
+
+	work(&job);
+	for (unsigned i = 0; i < spawned; ++i) pthread_join(workers[i], NULL);
+	if (workers != NULL) alloc.method(&alloc, workers, 0);
+}
+
+static unsigned thread_count(unsigned threads)
+{
+	if (threads > 0) return threads;
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+// Number of chunks for N elements, so that there's enough work for each one.
+static index_t chunk_count(index_t n, unsigned threads)
+{
+	index_t chunks = (index_t)threads * CHUNKS_PER_THREAD;
+	if (chunks > n / MIN_CHUNK) chunks = n / MIN_CHUNK;
+	return chunks > 0 ? chunks : 1;
+}
+
+// Start of the K-th out of CHUNKS evenly sized chunks of N elements.
+static inline index_t chunk_start(index_t n, index_t chunks, index_t k)
+{
+	return (unsigned long long)n * k / chunks;
+}
+
+
+struct for_each {
+	list_t *list;
+	index_t chunks;
+	void (*func)(void *element, void *forward);
+	void *forward;
+};
+
+static void for_each_chunk(void *context, index_t task)
+{
+	struct for_each *ctx = context;
+	const index_t n = ctx->list->length;
+	const size_t size = ctx->list->elem_size;
+	const index_t end = chunk_start(n, ctx->chunks, task + 1);
+	for (index_t i = chunk_start(n, ctx->chunks, task); i < end; ++i)
+		ctx->func(ctx->list->data + i * size, ctx->forward);
+}
+
+void parallel_for_each(list_t *list, unsigned threads,
+                       void (*func)(void *element, void *forward), void *forward)
+{
+	threads = thread_count(threads);
+	struct for_each ctx = {
+		.list = list,
+		.chunks = chunk_count(list->length, threads),
+		.func = func,
+		.forward = forward,
+	};
+	run_tasks(threads, ctx.chunks, list->alloc, for_each_chunk, &ctx);
+}
+
+
+struct transform {
+	const list_t *input;
+	list_t *output;
+	index_t chunks;
+	void (*func)(const void *in, void *out, void *forward);
+	void *forward;
+};
+
+static void transform_chunk(void *context, index_t task)
+{
+	struct transform *ctx = context;
+	const index_t n = ctx->input->length;
+	const size_t in_size = ctx->input->elem_size, out_size = ctx->output->elem_size;
+	const index_t end = chunk_start(n, ctx->chunks, task + 1);
+	for (index_t i = chunk_start(n, ctx->chunks, task); i < end; ++i)
+		ctx->func(ctx->input->data + i * in_size, ctx->output->data + i * out_size, ctx->forward);
+}
+
+err_t parallel_transform(const list_t *input, list_t *output, unsigned threads,
+                         void (*func)(const void *in, void *out, void *forward),
+                         void *forward)
+{
+	assert(input != output || input->elem_size == output->elem_size);
+	const err_t error = list_resize(output, input->length);
+	if (error) return error;
+
+	threads = thread_count(threads);
+	struct transform ctx = {
+		.input = input,
+		.output = output,
+		.chunks = chunk_count(input->length, threads),
+		.func = func,
+		.forward = forward,
+	};
+	run_tasks(threads, ctx.chunks, output->alloc, transform_chunk, &ctx);
+	return 0;
+}
+
+
+struct reduce {
+	const list_t *list;
+	index_t chunks;
+	byte_t *partials;
+	size_t result_size;
+	void (*accumulate)(void *acc, const void *element, void *forward);
+	void *forward;
+};
+
+static void reduce_chunk(void *context, index_t task)
+{
+	struct reduce *ctx = context;
+	const index_t n = ctx->list->length;
+	const size_t size = ctx->list->elem_size;
+	void *acc = ctx->partials + task * ctx->result_size;
+	const index_t end = chunk_start(n, ctx->chunks, task + 1);
+	for (index_t i = chunk_start(n, ctx->chunks, task); i < end; ++i)
+		ctx->accumulate(acc, ctx->list->data + i * size, ctx->forward);
+}
+
+err_t parallel_reduce(const list_t *list, unsigned threads, void *result, size_t result_size,
+                      void (*accumulate)(void *acc, const void *element, void *forward),
+                      void (*combine)(void *acc, const void *partial, void *forward),
+                      void *forward)
+{
+	threads = thread_count(threads);
+	struct reduce ctx = {
+		.list = list,
+		.chunks = chunk_count(list->length, threads),
+		.result_size = result_size,
+		.accumulate = accumulate,
+		.forward = forward,
+	};
+
+	// a single chunk can go straight into the result
+	if (ctx.chunks == 1) {
+		for (index_t i = 0; i < list->length; ++i)
+			accumulate(result, list->data + i * list->elem_size, forward);
+		return 0;
+	}
+
+	struct allocator alloc = list->alloc;
+	ctx.partials = alloc.method(&alloc, NULL, ctx.chunks * result_size);
+	if (ctx.partials == NULL) return ENOMEM;
+	for (index_t k = 0; k < ctx.chunks; ++k)
+		memcpy(ctx.partials + k * result_size, result, result_size);
+
+	run_tasks(threads, ctx.chunks, alloc, reduce_chunk, &ctx);
+
+	for (index_t k = 0; k < ctx.chunks; ++k)
+		combine(result, ctx.partials + k * result_size, forward);
+	alloc.method(&alloc, ctx.partials, 0);
+	return 0;
+}
+
+
+struct sort {
+	byte_t *from;
+	byte_t *to;
+	index_t n;
+	size_t size;
+	compare_fn_t compare;
+	index_t runs; // number of initial chunks
+	index_t width; // number of initial chunks in each run being merged
+	index_t segments; // number of tasks each merge is split into
+};
+
+static void sort_chunk(void *context, index_t task)
+{
+	struct sort *ctx = context;
+	const index_t lo = chunk_start(ctx->n, ctx->runs, task);
+	const index_t hi = chunk_start(ctx->n, ctx->runs, task + 1);
+	sort_intro(ctx->from + lo * ctx->size, hi - lo, ctx->size, ctx->compare);
+}
+
+// Finds how many of the first D merged elements come from A (the rest, from B).
+static index_t merge_split(const byte_t *a, index_t na, const byte_t *b, index_t nb,
+                           index_t d, size_t size, compare_fn_t compare)
+{
+	index_t lo = d > nb ? d - nb : 0;
+	index_t hi = d < na ? d : na;
+	while (lo < hi) {
+		const index_t i = lo + (hi - lo) / 2;
+		const index_t j = d - i;
+		// ties go to A, so A[i] is merged before B[j-1] unless strictly greater
+		if (compare(b + (j - 1) * size, a + i * size) >= 0) lo = i + 1;
+		else hi = i;
+	}
+	return lo;
+}
+
+static void merge_segment(void *context, index_t task)
+{
+	struct sort *ctx = context;
+	const index_t pair = task / ctx->segments, segment = task % ctx->segments;
+
+	index_t first = pair * 2 * ctx->width;
+	index_t middle = first + ctx->width < ctx->runs ? first + ctx->width : ctx->runs;
+	index_t last = middle + ctx->width < ctx->runs ? middle + ctx->width : ctx->runs;
+	first = chunk_start(ctx->n, ctx->runs, first);
+	middle = chunk_start(ctx->n, ctx->runs, middle);
+	last = chunk_start(ctx->n, ctx->runs, last);
+
+	const byte_t *a = ctx->from + first * ctx->size, *b = ctx->from + middle * ctx->size;
+	const index_t na = middle - first, nb = last - middle;
+	const index_t begin = chunk_start(na + nb, ctx->segments, segment);
+	const index_t end = chunk_start(na + nb, ctx->segments, segment + 1);
+	const index_t i0 = merge_split(a, na, b, nb, begin, ctx->size, ctx->compare);
+	const index_t i1 = merge_split(a, na, b, nb, end, ctx->size, ctx->compare);
+	const index_t j0 = begin - i0, j1 = end - i1;
+	sort_merge_arrays(ctx->to + (first + begin) * ctx->size,
+	                  a + i0 * ctx->size, i1 - i0, b + j0 * ctx->size, j1 - j0,
+	                  ctx->size, ctx->compare);
+}
+
+static void copy_chunk(void *context, index_t task)
+{
+	struct sort *ctx = context;
+	const index_t lo = chunk_start(ctx->n, ctx->runs, task);
+	const index_t hi = chunk_start(ctx->n, ctx->runs, task + 1);
+	memcpy(ctx->to + lo * ctx->size, ctx->from + lo * ctx->size, (hi - lo) * ctx->size);
+}
+
+err_t parallel_sort(list_t *list, unsigned threads, compare_fn_t compare)
+{
+	threads = thread_count(threads);
+	index_t runs = list->length / MIN_CHUNK;
+	if (runs > threads) runs = threads;
+	if (runs <= 1) {
+		sort_intro(list->data, list->length, list->elem_size, compare);
+		return 0;
+	}
+
+	struct allocator alloc = list->alloc;
+	byte_t *buffer = alloc.method(&alloc, NULL, list->length * list->elem_size);
+	if (buffer == NULL) return ENOMEM;
+
+	struct sort ctx = {
+		.from = list->data,
+		.to = buffer,
+		.n = list->length,
+		.size = list->elem_size,
+		.compare = compare,
+		.runs = runs,
+		.segments = threads,
+	};
+	run_tasks(threads, runs, alloc, sort_chunk, &ctx);
+
+	// merge runs back and forth between both arrays
+	for (ctx.width = 1; ctx.width < runs; ctx.width *= 2) {
+		const index_t pairs = (runs + 2 * ctx.width - 1) / (2 * ctx.width);
+		run_tasks(threads, pairs * ctx.segments, alloc, merge_segment, &ctx);
+		byte_t *temp = ctx.from;
+		ctx.from = ctx.to;
+		ctx.to = temp;
+	}
+	if (ctx.from != list->data) {
+		ctx.to = list->data;
+		run_tasks(threads, runs, alloc, copy_chunk, &ctx);
+	}
+
+	alloc.method(&alloc, buffer, 0);
+	return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file search.c
+ *
+ * In a tree stored in Eytzinger order, node K has children 2K and 2K+1 (the
+ * root is node 1), so a search walks down with K = 2K + (node K < key) and no
+ * branches at all. The descent only ends below a leaf, after which the lower
+ * bound is the last node where the search turned left: shifting K right past
+ * its trailing ones (right turns) and then one more bit (the left turn).
+ *
+ * Since the 16 great-grandchildren of a node are contiguous, prefetching node
+ * 16K hides the latency of the next four steps (with small enough elements).
+ *
+ * Mapping a node back to its position in the sorted array needs no lookup
+ * table (which would cost another cache miss): in a perfect tree, it follows
+ * from the node's depth and offset within its level, then we only need to
+ * discount the missing leaves to its left, if the last level isn't full.
+ */
+
+#include "search.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+#include <errno.h>
+
+#include "core.h" // byte_t, STDLIB_ALLOCATOR
+
+#if defined(__GNUC__)
+#	define PREFETCH(ADDR) __builtin_prefetch(ADDR)
+#else
+#	define PREFETCH(ADDR) ((void)(ADDR))
+#endif
+
+// How many searches are interleaved by batched lookups.
+#define BATCH_SIZE 16
+
+// How many levels ahead tree searches prefetch.
+#define PREFETCH_LEVELS 4
+
+
+index_t search_lower_bound(const void *base, index_t n, size_t size,
+                           const void *key, compare_fn_t compare)
+{
+	assert(n >= 0);
+	if (n == 0) return 0;
+
+	const byte_t *first = base;
+	const byte_t *cursor = first;
+	for (index_t length = n; length > 1; ) {
+		const index_t half = length / 2;
+		length -= half;
+		PREFETCH(cursor + (length / 2) * size);
+		PREFETCH(cursor + (half + length / 2) * size);
+		cursor = compare(key, cursor + half * size) > 0 ? cursor + half * size : cursor;
+	}
+	return (cursor - first) / size + (compare(key, cursor) > 0);
+}
+
+static inline int floor_log2(index_t x)
+{
+#if defined(__GNUC__)
+	return sizeof(unsigned long) * 8 - 1 - __builtin_clzl(x);
+#else
+	int log = 0;
+	while (x >>= 1) log++;
+	return log;
+#endif
+}
+
+// Copies sorted elements into the subtree rooted at node K, in order.
+static index_t build_tree(search_tree_t *tree, const byte_t *sorted, index_t i, index_t k)
+{
+	if (k > tree->length) return i;
+	i = build_tree(tree, sorted, i, 2 * k);
+	memcpy(tree->nodes + k * tree->elem_size, sorted + i * tree->elem_size, tree->elem_size);
+	return build_tree(tree, sorted, i + 1, 2 * k + 1);
+}
+
+err_t search_tree_init(search_tree_t *tree, const void *base, index_t n, size_t size,
+                       compare_fn_t compare, struct allocator alloc)
+{
+	assert(n >= 0);
+	assert(size > 0);
+	assert(compare != NULL);
+
+	tree->length = n;
+	tree->elem_size = size;
+	tree->compare = compare;
+	tree->alloc = alloc.method != NULL ? alloc : STDLIB_ALLOCATOR;
+
+	// nodes are 1-indexed, node 0 is never used
+	tree->nodes = tree->alloc.method(&tree->alloc, NULL, (n + 1) * size);
+	if (tree->nodes == NULL) return ENOMEM;
+	build_tree(tree, base, 0, 1);
+	return 0;
+}
+
+void search_tree_destroy(search_tree_t *tree)
+{
+	tree->alloc.method(&tree->alloc, tree->nodes, 0);
+}
+
+// Maps the node reached below a leaf to the rank of the lower bound.
+static inline index_t lower_bound_rank(const search_tree_t *tree, index_t k)
+{
+	while (k & 1) k >>= 1;
+	k >>= 1;
+	if (k == 0) return tree->length;
+
+	// rank of node K in a perfect tree with as many levels as ours
+	const int height = floor_log2(tree->length) + 1;
+	const int depth = floor_log2(k);
+	const index_t offset = k - ((index_t)1 << depth);
+	const index_t rank = ((2 * offset + 1) << (height - 1 - depth)) - 1;
+
+	// leaves are at even ranks, but only the leftmost ones in the last level exist
+	const index_t leaves = tree->length - (((index_t)1 << (height - 1)) - 1);
+	const index_t missing = (rank + 1) / 2 - leaves;
+	return missing > 0 ? rank - missing : rank;
+}
+
+static inline index_t descend(const search_tree_t *tree, index_t k, const void *key)
+{
+	const size_t size = tree->elem_size;
+	const index_t ahead = (index_t)1 << PREFETCH_LEVELS;
+	if (k * ahead <= tree->length) PREFETCH(tree->nodes + k * ahead * size);
+	return 2 * k + (tree->compare(key, tree->nodes + k * size) > 0);
+}
+
+index_t search_tree_lower_bound(const search_tree_t *tree, const void *key)
+{
+	index_t k = 1;
+	while (k <= tree->length) k = descend(tree, k, key);
+	return lower_bound_rank(tree, k);
+}
+
+void search_tree_lower_bound_many(const search_tree_t *tree, index_t n,
+                                  const void *keys, size_t key_size, index_t *indexes)
+{
+	const byte_t *key = keys;
+	for (index_t i = 0; i < n; i += BATCH_SIZE) {
+		const index_t batch = n - i < BATCH_SIZE ? n - i : BATCH_SIZE;
+		index_t k[BATCH_SIZE];
+		for (index_t b = 0; b < batch; ++b) k[b] = 1;
+
+		// every search is at the same depth, give or take the last level
+		for (bool pending = true; pending; ) {
+			pending = false;
+			for (index_t b = 0; b < batch; ++b) {
+				if (k[b] > tree->length) continue;
+				k[b] = descend(tree, k[b], key + (i + b) * key_size);
+				pending = true;
+			}
+		}
+
+		for (index_t b = 0; b < batch; ++b) indexes[i + b] = lower_bound_rank(tree, k[b]);
+	}
+}
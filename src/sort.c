@@ -0,0 +1,296 @@
+/**
+ * @file sort.c
+ *
+ * Besides comparisons, generic sorts spend most of their time moving elements
+ * whose size is only known at runtime. So both comparison sorts below are
+ * written as non-recursive inline functions and instantiated for a few constant
+ * sizes, letting the compiler turn each element move into register moves.
+ */
+
+#include "sort.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+#include <stdint.h> // uint32_t, uint64_t
+#include <errno.h>
+
+#include "core.h" // byte_t, memswap, STDLIB_ALLOCATOR
+
+
+// Ranges up to this size are insertion sorted.
+#define INSERTION_THRESHOLD 16
+
+// Elements up to this size are swapped through a stack buffer.
+#define SMALL_ELEMENT 32
+
+// Enough pending ranges for any index_t, since we always defer the larger half.
+#define MAX_PENDING (sizeof(index_t) * 8)
+
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
+
+static inline void swap_elements(byte_t *a, byte_t *b, size_t size)
+{
+	if (size <= SMALL_ELEMENT) {
+		byte_t temp[SMALL_ELEMENT];
+		memcpy(temp, a, size);
+		memcpy(a, b, size);
+		memcpy(b, temp, size);
+	} else {
+		memswap(a, b, size);
+	}
+}
+
+static inline void insertion_sort(byte_t *base, index_t n, size_t size, compare_fn_t compare)
+{
+	for (index_t i = 1; i < n; ++i) {
+		for (byte_t *e = base + i * size; e > base && compare(e - size, e) > 0; e -= size)
+			swap_elements(e - size, e, size);
+	}
+}
+
+static inline void sift_down(byte_t *base, index_t root, index_t n, size_t size,
+                             compare_fn_t compare)
+{
+	for (index_t child = 2 * root + 1; child < n; root = child, child = 2 * root + 1) {
+		if (child + 1 < n && compare(base + child * size, base + (child + 1) * size) < 0)
+			child++;
+		if (compare(base + root * size, base + child * size) >= 0) return;
+		swap_elements(base + root * size, base + child * size, size);
+	}
+}
+
+static inline void heap_sort(byte_t *base, index_t n, size_t size, compare_fn_t compare)
+{
+	for (index_t i = n / 2 - 1; i >= 0; --i) sift_down(base, i, n, size, compare);
+	for (index_t end = n - 1; end > 0; --end) {
+		swap_elements(base, base + end * size, size);
+		sift_down(base, 0, end, size, compare);
+	}
+}
+
+// Partitions [lo, hi) around a median of three, returning the pivot's final index.
+static inline index_t partition(byte_t *base, index_t lo, index_t hi, size_t size,
+                                compare_fn_t compare)
+{
+	byte_t *first = base + lo * size;
+	byte_t *middle = base + (lo + (hi - lo) / 2) * size;
+	byte_t *last = base + (hi - 1) * size;
+	if (compare(middle, first) < 0) swap_elements(middle, first, size);
+	if (compare(last, middle) < 0) {
+		swap_elements(last, middle, size);
+		if (compare(middle, first) < 0) swap_elements(middle, first, size);
+	}
+
+	// pivot goes to the front, while the last element bounds the forward scan
+	swap_elements(first, middle, size);
+	byte_t *pivot = first;
+	index_t i = lo, j = hi - 1;
+	for (;;) {
+		do i++; while (compare(base + i * size, pivot) < 0);
+		do j--; while (compare(pivot, base + j * size) < 0);
+		if (i >= j) break;
+		swap_elements(base + i * size, base + j * size, size);
+	}
+	swap_elements(pivot, base + j * size, size);
+	return j;
+}
+
+static inline void introsort(byte_t *base, index_t n, size_t size, compare_fn_t compare)
+{
+	struct range { index_t lo, hi; int depth; } pending[MAX_PENDING];
+	int top = 0;
+
+	int depth = 0;
+	for (index_t m = n; m > 1; m /= 2) depth += 2;
+
+	index_t lo = 0, hi = n;
+	for (;;) {
+		while (hi - lo > INSERTION_THRESHOLD) {
+			if (depth-- == 0) {
+				heap_sort(base + lo * size, hi - lo, size, compare);
+				break;
+			}
+			const index_t p = partition(base, lo, hi, size, compare);
+			if (p - lo < hi - p - 1) {
+				pending[top++] = (struct range){ p + 1, hi, depth };
+				hi = p;
+			} else {
+				pending[top++] = (struct range){ lo, p, depth };
+				lo = p + 1;
+			}
+		}
+		if (hi - lo <= INSERTION_THRESHOLD)
+			insertion_sort(base + lo * size, hi - lo, size, compare);
+
+		if (top == 0) return;
+		top--;
+		lo = pending[top].lo;
+		hi = pending[top].hi;
+		depth = pending[top].depth;
+	}
+}
+
+void sort_intro(void *base, index_t n, size_t size, compare_fn_t compare)
+{
+	assert(n >= 0);
+	assert(size > 0);
+
+	switch (size) {
+	case 4: introsort(base, n, 4, compare); break;
+	case 8: introsort(base, n, 8, compare); break;
+	case 16: introsort(base, n, 16, compare); break;
+	default: introsort(base, n, size, compare); break;
+	}
+}
+
+// Merges sorted runs [a, a+na) and [b, b+nb) into out, preferring the first on ties.
+static inline void merge(byte_t *out, const byte_t *a, index_t na, const byte_t *b, index_t nb,
+                         size_t size, compare_fn_t compare)
+{
+	const byte_t *a_end = a + na * size, *b_end = b + nb * size;
+	while (a < a_end && b < b_end) {
+		if (compare(b, a) < 0) {
+			memcpy(out, b, size);
+			b += size;
+		} else {
+			memcpy(out, a, size);
+			a += size;
+		}
+		out += size;
+	}
+	memcpy(out, a, a_end - a);
+	memcpy(out + (a_end - a), b, b_end - b);
+}
+
+void sort_merge_arrays(void *out, const void *a, index_t na, const void *b, index_t nb,
+                       size_t size, compare_fn_t compare)
+{
+	assert(na >= 0 && nb >= 0);
+	assert(size > 0);
+	if (na > 0 && nb > 0) merge(out, a, na, b, nb, size, compare);
+	else if (na > 0) memcpy(out, a, na * size);
+	else if (nb > 0) memcpy(out, b, nb * size);
+}
+
+static inline void merge_sort(byte_t *base, byte_t *buffer, index_t n, size_t size,
+                              compare_fn_t compare)
+{
+	// insertion sort only swaps adjacent unordered elements, so it is stable
+	for (index_t i = 0; i < n; i += INSERTION_THRESHOLD) {
+		const index_t run = n - i < INSERTION_THRESHOLD ? n - i : INSERTION_THRESHOLD;
+		insertion_sort(base + i * size, run, size, compare);
+	}
+
+	// merge runs of doubling width back and forth between both arrays
+	byte_t *from = base, *to = buffer;
+	for (index_t width = INSERTION_THRESHOLD; width < n; width *= 2) {
+		for (index_t lo = 0; lo < n; lo += 2 * width) {
+			const index_t mid = lo + width < n ? lo + width : n;
+			const index_t hi = mid + width < n ? mid + width : n;
+			byte_t *left = from + lo * size, *right = from + mid * size;
+			if (mid == hi || compare(right - size, right) <= 0) {
+				memcpy(to + lo * size, left, (hi - lo) * size); // already in order
+			} else {
+				merge(to + lo * size, left, mid - lo, right, hi - mid, size, compare);
+			}
+		}
+		byte_t *temp = from;
+		from = to;
+		to = temp;
+	}
+	if (from != base) memcpy(base, from, n * size);
+}
+
+err_t sort_merge(void *base, index_t n, size_t size, compare_fn_t compare,
+                 struct allocator alloc)
+{
+	assert(n >= 0);
+	assert(size > 0);
+	if (n <= INSERTION_THRESHOLD) {
+		insertion_sort(base, n, size, compare);
+		return 0;
+	}
+
+	if (alloc.method == NULL) alloc = STDLIB_ALLOCATOR;
+	byte_t *buffer = alloc.method(&alloc, NULL, n * size);
+	if (buffer == NULL) return ENOMEM;
+
+	switch (size) {
+	case 4: merge_sort(base, buffer, n, 4, compare); break;
+	case 8: merge_sort(base, buffer, n, 8, compare); break;
+	case 16: merge_sort(base, buffer, n, 16, compare); break;
+	default: merge_sort(base, buffer, n, size, compare); break;
+	}
+
+	alloc.method(&alloc, buffer, 0);
+	return 0;
+}
+
+// Gets an element's key, with any bits above the MASK'ed ones cleared.
+static inline uint64_t radix_key(const byte_t *element, size_t size, sort_key_fn_t key,
+                                 uint64_t mask)
+{
+	if (key != NULL) return key(element) & mask;
+	if (size == sizeof(uint32_t)) {
+		uint32_t x;
+		memcpy(&x, element, sizeof(x));
+		return x & mask;
+	} else {
+		uint64_t x;
+		memcpy(&x, element, sizeof(x));
+		return x & mask;
+	}
+}
+
+err_t sort_radix(void *base, index_t n, size_t size, sort_key_fn_t key, unsigned key_bits,
+                 struct allocator alloc)
+{
+	assert(n >= 0);
+	assert(size > 0);
+	assert(key != NULL || size == sizeof(uint32_t) || size == sizeof(uint64_t));
+	assert(key_bits <= 64);
+	if (n < 2) return 0;
+
+	// count every digit of every key in a single pass, where the last one may be partial
+	const unsigned passes = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+	const uint64_t mask = key_bits < 64 ? ((uint64_t)1 << key_bits) - 1 : UINT64_MAX;
+	index_t counts[64 / RADIX_BITS][RADIX] = {{0}};
+	for (index_t i = 0; i < n; ++i) {
+		const uint64_t k = radix_key((byte_t *)base + i * size, size, key, mask);
+		for (unsigned p = 0; p < passes; ++p) counts[p][(k >> (p * RADIX_BITS)) & (RADIX - 1)]++;
+	}
+
+	if (alloc.method == NULL) alloc = STDLIB_ALLOCATOR;
+	byte_t *buffer = alloc.method(&alloc, NULL, n * size);
+	if (buffer == NULL) return ENOMEM;
+
+	byte_t *from = base, *to = buffer;
+	for (unsigned p = 0; p < passes; ++p) {
+		// a digit shared by all keys wouldn't move anything
+		const uint64_t k0 = radix_key(from, size, key, mask);
+		if (counts[p][(k0 >> (p * RADIX_BITS)) & (RADIX - 1)] == n) continue;
+
+		index_t offsets[RADIX];
+		index_t sum = 0;
+		for (int d = 0; d < RADIX; ++d) {
+			offsets[d] = sum;
+			sum += counts[p][d];
+		}
+
+		for (index_t i = 0; i < n; ++i) {
+			const byte_t *element = from + i * size;
+			const unsigned d = (radix_key(element, size, key, mask) >> (p * RADIX_BITS)) & (RADIX - 1);
+			memcpy(to + offsets[d]++ * size, element, size);
+		}
+
+		byte_t *temp = from;
+		from = to;
+		to = temp;
+	}
+	if (from != base) memcpy(base, from, n * size);
+
+	alloc.method(&alloc, buffer, 0);
+	return 0;
+}
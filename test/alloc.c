@@ -5,6 +5,14 @@
 
 #include <string.h> // strcpy, strcmp
 #include <stdlib.h> // rand
+#include <stdint.h> // uintptr_t
+#include <stdalign.h> // alignof
+#include <stddef.h> // max_align_t
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <ugly/list.h>
 
 
 static void bump_allocator(void)
@@ -130,9 +138,474 @@ static void pool_allocator(void)
 #undef MAX_ELEMS
 }
 
+static bool aligned(const void *ptr, size_t alignment)
+{
+	return (uintptr_t)ptr % alignment == 0;
+}
+
+static void extended_allocators(void)
+{
+	byte_t buffer[1024];
+	size_t usable;
+
+	// bump blocks get over-aligned and report the padding up to the next one
+	bump_allocator_t bump;
+	struct allocator alloc = make_bump_allocator(&bump, buffer, sizeof(buffer));
+	byte_t *a = allocator_resize(&alloc, NULL, 3, 0, &usable);
+	assert(a != NULL);
+	assert(usable >= 3 && aligned(a + usable, alignof(max_align_t)));
+	byte_t *b = allocator_resize(&alloc, NULL, 100, 256, &usable);
+	assert(b != NULL && aligned(b, 256));
+	assert(usable >= 100);
+	assert(allocator_resize(&alloc, b, 200, 256, &usable) == b);
+	assert(usable >= 200);
+	assert(allocator_resize(&alloc, NULL, sizeof(buffer), 64, NULL) == NULL);
+
+	// stack blocks can be over-aligned too, and still be freed in LIFO order
+	stack_allocator_t stack;
+	alloc = make_stack_allocator(&stack, buffer, sizeof(buffer));
+	a = allocator_resize(&alloc, NULL, 10, 0, &usable);
+	assert(a != NULL && usable >= 10);
+	b = allocator_resize(&alloc, NULL, 10, 128, &usable);
+	assert(b != NULL && aligned(b, 128));
+	assert(usable >= 10);
+	byte_t *const top = stack.current;
+	alloc.method(&alloc, b, 0);
+	alloc.method(&alloc, a, 0);
+	assert(stack.current < top);
+	a = allocator_resize(&alloc, NULL, sizeof(buffer) - 64, 0, NULL);
+	assert(a != NULL);
+	alloc.method(&alloc, a, 0);
+
+	// pool chunks are always whole
+	pool_allocator_t pool;
+	alloc = make_pool_allocator(&pool, buffer, sizeof(buffer), 48);
+	a = allocator_resize(&alloc, NULL, 1, 16, &usable);
+	assert(a != NULL && usable == 48);
+	assert(allocator_resize(&alloc, a, 40, 16, &usable) == a);
+	assert(allocator_resize(&alloc, a, 49, 16, &usable) == NULL);
+
+	// the default allocator handles any power of two
+	alloc = STDLIB_ALLOCATOR;
+	a = allocator_resize(&alloc, NULL, 100, 4096, &usable);
+	assert(a != NULL && aligned(a, 4096));
+	assert(usable >= 100);
+	memset(a, 42, 100);
+	a = allocator_resize(&alloc, a, 10000, 4096, &usable);
+	assert(a != NULL && aligned(a, 4096));
+	assert(usable >= 10000);
+	assert(a[99] == 42);
+	allocator_resize(&alloc, a, 0, 4096, NULL);
+
+	// while basic allocators are only used when they happen to be aligned enough
+	alloc = (struct allocator){ .method = stdlib_alloc };
+	a = allocator_resize(&alloc, NULL, 100, 1, &usable);
+	assert(a != NULL && usable == 100);
+	alloc.method(&alloc, a, 0);
+}
+
+#define THREADS 8
+#define MESSAGES_PER_THREAD 100000
+
+struct message {
+	int sender;
+	int sequence;
+	long checksum;
+};
+
+struct courier {
+	struct allocator alloc;
+	_Atomic(struct message *) *mailboxes;
+	int id;
+};
+
+// Each thread keeps sending messages to the next one, freeing those it gets.
+static void *deliver(void *arg)
+{
+	struct courier *courier = arg;
+	struct allocator alloc = courier->alloc;
+	for (int i = 0; i < MESSAGES_PER_THREAD; ++i) {
+		struct message *message = alloc.method(&alloc, NULL, sizeof(struct message));
+		if (message == NULL) continue; // others might be holding every chunk
+		*message = (struct message){
+			.sender = courier->id,
+			.sequence = i,
+			.checksum = (long)courier->id * MESSAGES_PER_THREAD + i,
+		};
+
+		const int to = (courier->id + 1) % THREADS;
+		struct message *received = atomic_exchange(&courier->mailboxes[to], message);
+		received = atomic_exchange(&courier->mailboxes[courier->id], received);
+		if (received == NULL) continue;
+		assert(received->checksum == (long)received->sender * MESSAGES_PER_THREAD + received->sequence);
+		alloc.method(&alloc, received, 0);
+	}
+	return NULL;
+}
+
+static void concurrent_pool_allocator(void)
+{
+	enum { CHUNKS = 1024 };
+	static byte_t buffer[CHUNKS * 32 + 16];
+	static concurrent_pool_allocator_t pool;
+	struct allocator alloc = make_concurrent_pool_allocator(&pool, buffer, sizeof(buffer), 20);
+	assert(pool.chunk_size % alignof(max_align_t) == 0);
+	assert(pool.count == CHUNKS);
+
+	_Atomic(struct message *) mailboxes[THREADS];
+	for (int t = 0; t < THREADS; ++t) atomic_init(&mailboxes[t], NULL);
+	struct courier couriers[THREADS];
+	pthread_t threads[THREADS];
+	for (int t = 0; t < THREADS; ++t) {
+		couriers[t] = (struct courier){ .alloc = alloc, .mailboxes = mailboxes, .id = t };
+		const int err = pthread_create(&threads[t], NULL, deliver, &couriers[t]);
+		assert(!err);
+	}
+	for (int t = 0; t < THREADS; ++t) pthread_join(threads[t], NULL);
+	for (int t = 0; t < THREADS; ++t) {
+		if (mailboxes[t] != NULL) alloc.method(&alloc, mailboxes[t], 0);
+	}
+
+	// every chunk is back in the pool, either shared or cached
+	int free_chunks = 0;
+	for (int m = 0; m < POOL_MAGAZINES; ++m) free_chunks += pool.magazines[m].count;
+	for (uint32_t id = atomic_load(&pool.head); id != 0; ++free_chunks)
+		id = *(uint32_t *)(pool.chunks + (id - 1) * pool.chunk_size);
+	free_chunks += pool.count - atomic_load(&pool.carved);
+	assert(free_chunks == CHUNKS);
+
+	// and there's no more than that
+	void *chunks[CHUNKS];
+	int allocated = 0;
+	while (allocated < CHUNKS && (chunks[allocated] = alloc.method(&alloc, NULL, 20)) != NULL)
+		allocated++;
+	assert(alloc.method(&alloc, NULL, 20) == NULL);
+	while (allocated > 0) alloc.method(&alloc, chunks[--allocated], 0);
+	assert(alloc.method(&alloc, NULL, pool.chunk_size + 1) == NULL);
+}
+
+static void *hoard_chunks(void *arg)
+{
+	struct allocator *alloc = arg;
+	void *chunk = alloc->method(alloc, NULL, 8);
+	assert(chunk != NULL);
+	alloc->method(alloc, chunk, 0);
+	return NULL;
+}
+
+static void concurrent_pools(void)
+{
+	enum { CHUNKS = 64 };
+	static byte_t buffers[2][CHUNKS * 16];
+	static concurrent_pool_allocator_t pools[2];
+	struct allocator allocs[2];
+	for (int p = 0; p < 2; ++p)
+		allocs[p] = make_concurrent_pool_allocator(&pools[p], buffers[p], sizeof(buffers[p]), 16);
+	assert(atomic_load(&pools[0].carved) == 0);
+
+	// a thread may alternate between pools, and chunks always go back to their own
+	void *chunks[2][CHUNKS];
+	for (int round = 0; round < 2; ++round) {
+		int allocated[2] = {0, 0};
+		for (int i = 0; i < 2 * CHUNKS + 2; ++i) {
+			const int p = i % 2;
+			void *chunk = allocs[p].method(&allocs[p], NULL, 16);
+			if (chunk == NULL) continue;
+			assert((byte_t *)chunk >= buffers[p] && (byte_t *)chunk < buffers[p] + sizeof(buffers[p]));
+			chunks[p][allocated[p]++] = chunk;
+		}
+		assert(allocated[0] == pools[0].count && allocated[1] == pools[1].count);
+		for (int i = 0; i < 2 * CHUNKS; ++i) {
+			const int p = i % 2;
+			if (i / 2 < allocated[p]) allocs[p].method(&allocs[p], chunks[p][i / 2], 0);
+		}
+	}
+
+	// chunks cached by a thread which has exited are still there for the others
+	make_concurrent_pool_allocator(&pools[0], buffers[0], sizeof(buffers[0]), 16);
+	pthread_t thread;
+	const int err = pthread_create(&thread, NULL, hoard_chunks, &allocs[0]);
+	assert(!err);
+	pthread_join(thread, NULL);
+	int allocated = 0;
+	while (allocs[0].method(&allocs[0], NULL, 16) != NULL) allocated++;
+	assert(allocated == pools[0].count);
+}
+
+static int live_blocks = 0;
+
+static void *counting_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	if (ptr == NULL && size != 0) live_blocks++;
+	else if (ptr != NULL && size == 0) live_blocks--;
+	return realloc(ptr, size);
+}
+
+static void growable_pool_allocator(void)
+{
+	// chunks are rounded up to hold (aligned) pointers and are carved on demand
+	pool_allocator_t pool;
+	byte_t buffer[1000];
+	struct allocator alloc = make_pool_allocator(&pool, buffer, sizeof(buffer), 12);
+	assert(pool.chunk_size % alignof(void *) == 0 && pool.chunk_size >= 12);
+	assert(pool.free_list_head == NULL);
+	void *chunks[1000];
+	int n = 0;
+	while ((chunks[n] = alloc.method(&alloc, NULL, 12)) != NULL) {
+		assert((uintptr_t)chunks[n] % alignof(void *) == 0);
+		n++;
+	}
+	assert(n == sizeof(buffer) / pool.chunk_size || n == sizeof(buffer) / pool.chunk_size - 1);
+	for (int i = 0; i < n; ++i) alloc.method(&alloc, chunks[i], 0);
+	for (int i = 0; i < n; ++i) assert(alloc.method(&alloc, NULL, 12) != NULL);
+	assert(alloc.method(&alloc, NULL, 12) == NULL);
+
+	// growable pools take slabs from their parent instead of failing
+	const struct allocator counting = { .method = counting_alloc };
+	alloc = make_growable_pool_allocator(&pool, 48, 1024, counting);
+	assert(live_blocks == 0);
+	for (int i = 0; i < 1000; ++i) {
+		chunks[i] = alloc.method(&alloc, NULL, 48);
+		assert(chunks[i] != NULL);
+		assert((uintptr_t)chunks[i] % 16 == 0);
+		memset(chunks[i], i, 48);
+	}
+	const int slabs = live_blocks;
+	assert(slabs >= 1000 / (1024 / 48));
+	for (int i = 0; i < 1000; i += 2) alloc.method(&alloc, chunks[i], 0);
+	for (int i = 0; i < 1000; i += 2) chunks[i] = alloc.method(&alloc, NULL, 48);
+	assert(live_blocks == slabs); // freed chunks were reused
+	for (int i = 1; i < 1000; i += 2) assert(*(byte_t *)chunks[i] == (byte_t)i);
+
+	pool_release(&pool);
+	assert(live_blocks == 0);
+}
+
+static void *counting_alloc_extended(struct allocator *ctx, void *ptr, size_t size,
+                                     size_t alignment, size_t *usable)
+{
+	if (ptr == NULL && size != 0) live_blocks++;
+	else if (ptr != NULL && size == 0) live_blocks--;
+	return stdlib_alloc_extended(ctx, ptr, size, alignment, usable);
+}
+
+/*
+ * Keeps N blocks of random sizes (one in LARGE_ODDS of them up to MAX_LARGE
+ * bytes, the rest up to MAX_SMALL) for some ROUNDS, allocating, freeing and
+ * reallocating them in random order and checking their contents all along.
+ * Then frees them all and grows a list of LIST_LENGTH elements on top.
+ */
+static void exercise(struct allocator alloc, int n, int rounds, int large_odds,
+                     size_t max_small, size_t max_large, int list_length)
+{
+	enum { BLOCKS = 2000 };
+	static byte_t *blocks[BLOCKS];
+	static size_t sizes[BLOCKS];
+	assert(n <= BLOCKS);
+	for (int round = 0; round < rounds; ++round) {
+		for (int i = 0; i < n; ++i) {
+			const size_t size = rand() % large_odds == 0 ? 1 + rand() % max_large
+			                                             : 1 + rand() % max_small;
+			const int action = rand() % 3;
+			if (blocks[i] == NULL || action == 0) {
+				if (blocks[i] != NULL) alloc.method(&alloc, blocks[i], 0);
+				blocks[i] = alloc.method(&alloc, NULL, size);
+			} else if (action == 1) {
+				blocks[i] = alloc.method(&alloc, blocks[i], size);
+				for (size_t j = 0; j < size && j < sizes[i]; ++j) assert(blocks[i][j] == (byte_t)i);
+			} else {
+				continue;
+			}
+			assert(blocks[i] != NULL);
+			assert((uintptr_t)blocks[i] % alignof(max_align_t) == 0);
+			sizes[i] = size;
+			memset(blocks[i], i, size);
+		}
+		for (int i = 0; i < n; ++i) {
+			for (size_t j = 0; j < sizes[i]; ++j) assert(blocks[i][j] == (byte_t)i);
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		alloc.method(&alloc, blocks[i], 0);
+		blocks[i] = NULL;
+		sizes[i] = 0;
+	}
+
+	list_t list;
+	int err = list_init(&list, 0, sizeof(int), alloc);
+	assert(!err);
+	for (int i = 0; i < list_length; ++i) {
+		err = list_append(&list, &i);
+		assert(!err);
+	}
+	for (int i = 0; i < list_length; ++i) assert(*(int *)list_ref(&list, i) == i);
+	list_destroy(&list);
+}
+
+static void slab_allocator(void)
+{
+	static slab_allocator_t slab;
+	const struct allocator counting = {
+		.method = counting_alloc, .extended = counting_alloc_extended };
+	struct allocator alloc = make_slab_allocator(&slab, counting);
+	assert(live_blocks == 0);
+
+	// blocks of all sizes, freed and reallocated in random order
+	exercise(alloc, 2000, 10, 8, 300, 20000, 10000);
+
+	// reallocations within a size class happen in place
+	size_t usable;
+	byte_t *small = allocator_resize(&alloc, NULL, 100, 0, &usable);
+	assert(small != NULL && usable >= 100 && usable <= 120);
+	assert(alloc.method(&alloc, small, usable) == small);
+	alloc.method(&alloc, small, 0);
+
+	// large and over-aligned blocks come straight from the parent, without any slab overhead
+	const int before = live_blocks;
+	byte_t *large = allocator_resize(&alloc, NULL, 5000, 0, &usable);
+	assert(large != NULL && usable >= 5000 && usable < SLAB_SIZE);
+	assert(live_blocks == before + 1);
+	alloc.method(&alloc, large, 0);
+	byte_t *aligned = allocator_resize(&alloc, NULL, 100, 256, &usable);
+	assert(aligned != NULL && (uintptr_t)aligned % 256 == 0);
+	assert(usable < SLAB_SIZE);
+	alloc.method(&alloc, aligned, 0);
+	assert(live_blocks == before);
+
+	slab_release(&slab);
+	assert(live_blocks == 0);
+}
+
+static void tlsf_allocator(void)
+{
+	enum { BUFFER_SIZE = 1 << 20 };
+	static byte_t buffer[BUFFER_SIZE];
+	static tlsf_allocator_t tlsf;
+	struct allocator alloc = make_tlsf_allocator(&tlsf, buffer, sizeof(buffer));
+
+	// blocks of all sizes, freed and reallocated in random order, with lists growing in place
+	exercise(alloc, 500, 20, 16, 500, 10000, 100000);
+
+	// once everything is freed, it all coalesces back into a single block
+	byte_t *all = alloc.method(&alloc, NULL, BUFFER_SIZE - 64);
+	assert(all != NULL);
+	alloc.method(&alloc, all, 0);
+
+	// reallocations grow into the free space right after them
+	size_t usable;
+	byte_t *first = allocator_resize(&alloc, NULL, 100, 0, &usable);
+	assert(first != NULL && usable >= 100);
+	byte_t *second = alloc.method(&alloc, NULL, 100);
+	byte_t *third = alloc.method(&alloc, NULL, 100);
+	alloc.method(&alloc, second, 0);
+	assert(alloc.method(&alloc, first, 200) == first);
+	assert(alloc.method(&alloc, first, 20) == first);
+	assert(alloc.method(&alloc, third, 500000) == third);
+
+	// over-aligned blocks leave no gaps behind
+	byte_t *aligned = allocator_resize(&alloc, NULL, 100, 4096, NULL);
+	assert(aligned != NULL && (uintptr_t)aligned % 4096 == 0);
+	alloc.method(&alloc, aligned, 0);
+	alloc.method(&alloc, first, 0);
+	alloc.method(&alloc, third, 0);
+	all = alloc.method(&alloc, NULL, BUFFER_SIZE - 64);
+	assert(all != NULL);
+	alloc.method(&alloc, all, 0);
+}
+
+static void arena_allocator(void)
+{
+	arena_allocator_t arena;
+	const struct allocator counting = { .method = counting_alloc };
+	struct allocator alloc = make_arena_allocator(&arena, 1024, counting);
+	assert(live_blocks == 0);
+
+	// small allocations keep chaining blocks as they go
+	int *numbers[1000];
+	for (int i = 0; i < 1000; ++i) {
+		numbers[i] = alloc.method(&alloc, NULL, sizeof(int));
+		assert(numbers[i] != NULL);
+		*numbers[i] = i;
+	}
+	for (int i = 0; i < 1000; ++i) assert(*numbers[i] == i);
+	const int blocks = live_blocks;
+	assert(blocks > 1);
+
+	// big ones get a block of their own
+	byte_t *big = alloc.method(&alloc, NULL, 4096);
+	assert(big != NULL);
+	memset(big, 7, 4096);
+	assert(live_blocks == blocks + 1);
+	big = alloc.method(&alloc, big, 8192); // and may still be reallocated
+	assert(big != NULL);
+	for (int i = 0; i < 4096; ++i) assert(big[i] == 7);
+	assert(live_blocks == blocks + 1);
+
+	// without taking the place of the block being filled by smaller ones
+	assert(alloc.method(&alloc, NULL, sizeof(int)) != NULL);
+	assert(live_blocks == blocks + 1);
+	size_t usable = 0;
+	byte_t *aligned = allocator_resize(&alloc, NULL, 2048, 4096, &usable);
+	assert(aligned != NULL && (uintptr_t)aligned % 4096 == 0 && usable >= 2048);
+	memset(aligned, 1, usable);
+	assert(live_blocks == blocks + 2);
+
+	// markers free everything allocated since then, in any number of blocks
+	const arena_marker_t marker = arena_save(&arena);
+	char *text = alloc.method(&alloc, NULL, 6);
+	strcpy(text, "hello");
+	for (int i = 0; i < 100; ++i) {
+		text = alloc.method(&alloc, text, 6 + i * 100); // outgrows its block
+		assert(text != NULL);
+		assert(strcmp(text, "hello") == 0);
+	}
+	assert(live_blocks > blocks + 2);
+	arena_restore(&arena, marker);
+	assert(live_blocks == blocks + 2);
+	assert(alloc.method(&alloc, NULL, 16) != NULL);
+
+	// lists work just fine on top of arenas
+	list_t list;
+	int err = list_init(&list, 0, sizeof(int), alloc);
+	assert(!err);
+	for (int i = 0; i < 10000; ++i) {
+		err = list_append(&list, &i);
+		assert(!err);
+	}
+	for (int i = 0; i < 10000; ++i) assert(*(int *)list_ref(&list, i) == i);
+	list_destroy(&list);
+
+	arena_reset(&arena);
+	assert(live_blocks == 0);
+
+	// blocks of their own can't move once a marker refers to them, but may still change in place
+	big = alloc.method(&alloc, NULL, 4000);
+	assert(big != NULL);
+	memset(big, 3, 4000);
+	const arena_marker_t pinned = arena_save(&arena);
+	assert(alloc.method(&alloc, big, 8000) == NULL);
+	assert(alloc.method(&alloc, big, 2000) == big);
+	byte_t *newer = alloc.method(&alloc, NULL, 4000);
+	assert(newer != NULL);
+	newer = alloc.method(&alloc, newer, 8000); // unlike those allocated after it
+	assert(newer != NULL);
+	arena_restore(&arena, pinned);
+	assert(live_blocks == 1);
+	for (int i = 0; i < 2000; ++i) assert(big[i] == 3);
+	arena_reset(&arena);
+	assert(live_blocks == 0);
+}
+
 int main(void)
 {
 	bump_allocator();
 	stack_allocator();
 	pool_allocator();
+	extended_allocators();
+	concurrent_pool_allocator();
+	concurrent_pools();
+	growable_pool_allocator();
+	slab_allocator();
+	tlsf_allocator();
+	arena_allocator();
 }
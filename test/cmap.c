@@ -0,0 +1,146 @@
+#include <ugly/cmap.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+
+#define THREADS 8
+#define KEYS_PER_THREAD 16384
+#define COUNTERS 64
+
+static int intcmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+struct worker {
+	cmap_t *cmap;
+	int id;
+};
+
+static void increment(void *value, bool created, void *forward)
+{
+	long *counter = value;
+	if (created) *counter = 0;
+	*counter += 1;
+}
+
+// Each thread inserts its own keys, increments shared counters, checks some
+// of its neighbours' entries and then removes half of its own.
+static void *work(void *arg)
+{
+	struct worker *worker = arg;
+	cmap_t *cmap = worker->cmap;
+	const int base = COUNTERS + worker->id * KEYS_PER_THREAD;
+
+	for (int i = 0; i < KEYS_PER_THREAD; ++i) {
+		const int key = base + i;
+		const long value = 2L * key;
+		err_t err = cmap_insert(cmap, &key, &value);
+		assert(err == 0);
+
+		const int counter = i % COUNTERS;
+		err = cmap_upsert(cmap, &counter, increment, NULL);
+		assert(!err);
+
+		// entries from other threads may or may not be there yet, but must be consistent
+		const int other = COUNTERS + ((worker->id + 1) % THREADS) * KEYS_PER_THREAD + i;
+		long found;
+		if (cmap_get(cmap, &other, &found)) assert(found == 2L * other);
+	}
+
+	for (int i = 0; i < KEYS_PER_THREAD; i += 2) {
+		const int key = base + i;
+		err_t err = cmap_remove(cmap, &key);
+		assert(!err);
+		err = cmap_remove(cmap, &key);
+		assert(err == ENOKEY);
+	}
+
+	return NULL;
+}
+
+static err_t sum_values(const void *key, void *value, void *forward)
+{
+	if (*(const int *)key < COUNTERS) return 0;
+	assert(*(const long *)value == 2L * *(const int *)key);
+	atomic_fetch_add((atomic_long *)forward, 1);
+	return 0;
+}
+
+static err_t stop_at_counter(const void *key, void *value, void *forward)
+{
+	return *(const int *)key == 0 ? -42 : 0;
+}
+
+static atomic_int hash_calls;
+
+static hash_t counting_hash(const void *key, size_t size)
+{
+	atomic_fetch_add(&hash_calls, 1);
+	return hash_u32(key, size);
+}
+
+// Shards are picked with the same hash their maps use, so keys are hashed once.
+static void hash_once(void)
+{
+	cmap_t cmap;
+	err_t err = cmap_init(&cmap, 16, 0, sizeof(int), sizeof(long), intcmp, counting_hash,
+	                      STDLIB_ALLOCATOR);
+	assert(!err);
+	atomic_init(&hash_calls, 0);
+	const int key = 42;
+	long value = 7;
+	err = cmap_insert(&cmap, &key, &value);
+	assert(!err);
+	assert(cmap_get(&cmap, &key, &value) && value == 7);
+	err = cmap_remove(&cmap, &key);
+	assert(!err);
+	assert(atomic_load(&hash_calls) == 3);
+	cmap_destroy(&cmap);
+}
+
+int main(void)
+{
+	hash_once();
+
+	cmap_t cmap;
+	err_t err = cmap_init(&cmap, 0, 0, sizeof(int), sizeof(long), intcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	pthread_t threads[THREADS];
+	struct worker workers[THREADS];
+	for (int t = 0; t < THREADS; ++t) {
+		workers[t] = (struct worker){ .cmap = &cmap, .id = t };
+		err = pthread_create(&threads[t], NULL, work, &workers[t]);
+		assert(!err);
+	}
+	for (int t = 0; t < THREADS; ++t) pthread_join(threads[t], NULL);
+
+	assert(cmap_size(&cmap) == COUNTERS + THREADS * KEYS_PER_THREAD / 2);
+
+	// no increment may be lost
+	for (int c = 0; c < COUNTERS; ++c) {
+		long count;
+		const bool found = cmap_get(&cmap, &c, &count);
+		assert(found);
+		assert(count == THREADS * KEYS_PER_THREAD / COUNTERS);
+	}
+	const int removed = COUNTERS;
+	assert(!cmap_get(&cmap, &removed, NULL));
+
+	atomic_long visited;
+	atomic_init(&visited, 0);
+	err = cmap_for_each(&cmap, 4, sum_values, &visited);
+	assert(!err);
+	assert(atomic_load(&visited) == THREADS * KEYS_PER_THREAD / 2);
+
+	err = cmap_for_each(&cmap, 0, stop_at_counter, NULL);
+	assert(err == -42);
+
+	cmap_destroy(&cmap);
+}
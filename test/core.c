@@ -3,8 +3,10 @@
 #undef NDEBUG
 #include <assert.h>
 
-#include <string.h> // strcpy, strcmp
-#include <stdlib.h> // malloc, free
+#include <string.h> // strcpy, strcmp, memcmp
+#include <stdlib.h> // malloc, free, rand
+#include <stdio.h> // printf
+#include <time.h> // clock
 
 
 static void memswap_primitives(void)
@@ -25,6 +27,66 @@ static void memswap_pointers(void)
 	assert(strcmp(s2, "Hello, generic") == 0);
 }
 
+static void memswap_sizes(void)
+{
+#define MAX_SIZE 300
+	unsigned char a[MAX_SIZE + 1], b[MAX_SIZE + 1], a0[MAX_SIZE + 1], b0[MAX_SIZE + 1];
+	for (int i = 0; i <= MAX_SIZE; ++i) {
+		a0[i] = rand();
+		b0[i] = rand();
+	}
+
+	// every size, also at unaligned addresses, must swap exactly that many bytes
+	for (size_t size = 0; size < MAX_SIZE; ++size) {
+		memcpy(a, a0, sizeof(a));
+		memcpy(b, b0, sizeof(b));
+		memswap(a + 1, b + 1, size);
+		assert(a[0] == a0[0] && b[0] == b0[0]);
+		assert(memcmp(a + 1, b0 + 1, size) == 0);
+		assert(memcmp(b + 1, a0 + 1, size) == 0);
+		assert(memcmp(a + 1 + size, a0 + 1 + size, MAX_SIZE - size) == 0);
+		assert(memcmp(b + 1 + size, b0 + 1 + size, MAX_SIZE - size) == 0);
+	}
+#undef MAX_SIZE
+}
+
+static void byteswap(void *a, void *b, size_t size)
+{
+	unsigned char *x = a, *y = b;
+	for (unsigned char temp; size != 0; x++, y++, size--) {
+		temp = *x;
+		*x = *y;
+		*y = temp;
+	}
+}
+
+static void benchmark(void)
+{
+	const size_t sizes[] = {4, 8, 16, 64, 256};
+	const int n = 1000000;
+	unsigned char *records = malloc(2 * 256);
+	assert(records != NULL);
+	memset(records, 0x5A, 2 * 256);
+
+	for (int s = 0; s < ARRAY_SIZE(sizes); ++s) {
+		void (*swaps[])(void *, void *, size_t) = {byteswap, memswap};
+		float elapsedNs[2];
+		for (int f = 0; f < 2; ++f) {
+			const clock_t begin = clock();
+			for (int i = 0; i < n; ++i) {
+				swaps[f](records, records + sizes[s], sizes[s]);
+				__asm__ volatile("" ::: "memory"); // keep the loop from being folded
+			}
+			const clock_t end = clock();
+			elapsedNs[f] = end*1e9/CLOCKS_PER_SEC - begin*1e9/CLOCKS_PER_SEC;
+		}
+		printf("memswap(%3zu bytes): %.1f ns (bytewise: %.1f ns)\n",
+		       sizes[s], elapsedNs[1] / n, elapsedNs[0] / n);
+	}
+
+	free(records);
+}
+
 static void static_array_size(void)
 {
 #define N 50
@@ -58,6 +120,8 @@ int main(void)
 	assert(sizeof(byte_t) == 1);
 	memswap_primitives();
 	memswap_pointers();
+	memswap_sizes();
 	static_array_size();
 	struct_base_address();
+	benchmark();
 }
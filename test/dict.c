@@ -0,0 +1,127 @@
+#include <ugly/dict.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <string.h> // strcmp
+#include <stdlib.h> // rand
+#include <errno.h>
+
+#include <ugly/core.h> // ARRAY_SIZE
+
+
+static int strrefcmp(const void *a, const void *b)
+{
+	const char *str1 = *(const char **)a;
+	const char *str2 = *(const char **)b;
+	return strcmp(str1, str2);
+}
+
+static hash_t strhash(const void *ptr, size_t bytes)
+{
+	const char *str = *(const char **)ptr;
+	return wyhash(str, strlen(str));
+}
+
+struct cursor {
+	const char **expected;
+	int position;
+};
+
+static int check_order(const void *key, void *value, void *forward)
+{
+	struct cursor *cursor = forward;
+	const char *word = *(const char **)key;
+	assert(strcmp(word, cursor->expected[cursor->position]) == 0);
+	cursor->position++;
+	return 0;
+}
+
+static void ordering(void)
+{
+	const char *words[] = {"zeta", "alpha", "omega", "beta", "gamma"};
+	const int n = ARRAY_SIZE(words);
+
+	dict_t dict;
+	err_t err = dict_init(&dict, 0, sizeof(char *), sizeof(int),
+	                      strrefcmp, strhash, STDLIB_ALLOCATOR);
+	assert(!err);
+	assert(dict_empty(&dict));
+
+	for (int i = 0; i < n; ++i) {
+		err = dict_insert(&dict, &words[i], &i);
+		assert(!err);
+	}
+	assert(dict_size(&dict) == n);
+
+	// overwriting keeps the original position
+	const int zero = 0;
+	err = dict_insert(&dict, &words[2], &zero);
+	assert(err < 0);
+	assert(*(int *)dict_get(&dict, &words[2]) == 0);
+
+	// iteration is done in insertion order, even after removals
+	err = dict_remove(&dict, &words[1]);
+	assert(!err);
+	err = dict_remove(&dict, &words[1]);
+	assert(err == ENOKEY);
+	assert(dict_get(&dict, &words[1]) == NULL);
+	err = dict_insert(&dict, &words[1], &zero);
+	assert(!err);
+
+	const char *expected[] = {"zeta", "omega", "beta", "gamma", "alpha"};
+	struct cursor cursor = { .expected = expected, .position = 0 };
+	err = dict_for_each(&dict, check_order, &cursor);
+	assert(!err);
+	assert(cursor.position == n);
+
+	dict_destroy(&dict);
+}
+
+static int intrefcmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int check_increasing(const void *key, void *value, void *forward)
+{
+	int *last = forward;
+	assert(*(const int *)key == *(const long long *)value);
+	assert(*(const int *)key > *last);
+	*last = *(const int *)key;
+	return 0;
+}
+
+static void churn(void)
+{
+#define KEYS 100000
+	dict_t dict;
+	err_t err = dict_init(&dict, 0, sizeof(int), sizeof(long long),
+	                      intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// grow the index through all of its slot widths, removing some entries
+	for (int i = 0; i < KEYS; ++i) {
+		const long long value = i;
+		err = dict_insert(&dict, &i, &value);
+		assert(!err);
+		if (i % 3 == 0) {
+			const int old = rand() % (i + 1);
+			dict_remove(&dict, &old);
+		}
+	}
+
+	// keys were inserted in increasing order, so they must be iterated that way
+	int last = -1;
+	err = dict_for_each(&dict, check_increasing, &last);
+	assert(!err);
+
+	dict_destroy(&dict);
+#undef KEYS
+}
+
+int main(void)
+{
+	ordering();
+	churn();
+}
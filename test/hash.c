@@ -0,0 +1,50 @@
+#include <ugly/hash.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <string.h> // strlen
+#include <stdint.h> // uint32_t, uint64_t
+
+
+static void fnv_1a_vectors(void)
+{
+	assert(fnv_1a("", 0) == 0x811c9dc5ul);
+	assert(fnv_1a("a", 1) == 0xe40c292cul);
+	assert(fnv_1a("foobar", 6) == 0xbf9cf968ul);
+}
+
+static void wyhash_lengths(void)
+{
+	// check reference output, then make sure every input size path is sensitive
+	// to each of its bytes (including both sides of the overlapping reads)
+	if (sizeof(hash_t) >= 8) assert(wyhash("", 0) == (hash_t)0x0409638ee2bde459ull);
+	char text[128];
+	for (size_t i = 0; i < sizeof(text); ++i) text[i] = 'a' + i % 26;
+	for (size_t n = 1; n <= sizeof(text); ++n) {
+		const hash_t original = wyhash(text, n);
+		assert(original != wyhash(text, n - 1));
+		for (size_t i = 0; i < n; ++i) {
+			text[i] ^= 1;
+			assert(wyhash(text, n) != original);
+			text[i] ^= 1;
+		}
+	}
+}
+
+static void fixed_width(void)
+{
+	const uint32_t a = 42, b = 43;
+	assert(hash_u32(&a, sizeof(a)) == hash_u32(&a, sizeof(a)));
+	assert(hash_u32(&a, sizeof(a)) != hash_u32(&b, sizeof(b)));
+
+	const uint64_t c = 1ull << 40, d = 1ull << 41;
+	assert(hash_u64(&c, sizeof(c)) != hash_u64(&d, sizeof(d)));
+}
+
+int main(void)
+{
+	fnv_1a_vectors();
+	wyhash_lengths();
+	fixed_width();
+}
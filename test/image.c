@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L // truncate
+
+#include <ugly/image.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <errno.h>
+#include <stdint.h> // uint64_t
+#include <stdio.h> // remove
+#include <unistd.h> // truncate
+
+#include <ugly/list.h>
+#include <ugly/map.h>
+
+
+#define MAP_PATH "test_image.map"
+#define LIST_PATH "test_image.list"
+
+static int longcmp(const void *a, const void *b)
+{
+	const long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+static err_t check_entry(const void *key, void *value, void *forward)
+{
+	assert(*(const double *)value == *(const long *)key * 0.5);
+	*(index_t *)forward += 1;
+	return 0;
+}
+
+// Byte offsets of some header fields, as laid out by image.c.
+#define HEADER_COUNT 32
+#define HEADER_FILLED 40
+#define HEADER_CAPACITY 48
+#define HEADER_KEY_SIZE 56
+#define HEADER_CTRL_OFFSET 72
+#define HEADER_LENGTH 104
+
+// Overwrites a 64-bit header field of the image at PATH.
+static void patch(const char *path, long offset, uint64_t value)
+{
+	FILE *file = fopen(path, "r+b");
+	assert(file != NULL);
+	assert(fseek(file, offset, SEEK_SET) == 0);
+	assert(fwrite(&value, sizeof(value), 1, file) == 1);
+	assert(fclose(file) == 0);
+}
+
+// Reads a 64-bit header field of the image at PATH.
+static uint64_t peek(const char *path, long offset)
+{
+	uint64_t value;
+	FILE *file = fopen(path, "rb");
+	assert(file != NULL);
+	assert(fseek(file, offset, SEEK_SET) == 0);
+	assert(fread(&value, sizeof(value), 1, file) == 1);
+	assert(fclose(file) == 0);
+	return value;
+}
+
+static void corrupted(void)
+{
+	map_t map;
+	err_t err = map_init(&map, 0, sizeof(long), sizeof(double), longcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+	for (long i = 0; i < 100; ++i) {
+		const double value = i * 0.5;
+		err = map_insert(&map, &i, &value);
+		assert(!err);
+	}
+	list_t list;
+	err = list_init(&list, 0, sizeof(int), STDLIB_ALLOCATOR);
+	assert(!err);
+	for (int i = 0; i < 1000; ++i) {
+		err = list_append(&list, &i);
+		assert(!err);
+	}
+
+	map_t loaded_map;
+	list_t loaded_list;
+	image_t image;
+	const struct { long offset; uint64_t value; } map_patches[] = {
+		{ HEADER_COUNT, (uint64_t)map.filled + 1 }, // more entries than used buckets
+		{ HEADER_FILLED, (uint64_t)map.buckets.capacity + 1 }, // more than the capacity
+		{ HEADER_FILLED, (uint64_t)map.buckets.capacity }, // no EMPTY bucket left
+		{ HEADER_COUNT, (uint64_t)map.count - 1 }, // disagrees with the control bytes
+		{ HEADER_CAPACITY, (uint64_t)map.buckets.capacity + 1 }, // not a power of two
+		{ HEADER_CAPACITY, 1 }, // smaller than a probing group
+		{ HEADER_KEY_SIZE, UINT64_MAX / 2 + 1 }, // overflows into a small section size
+	};
+	for (size_t i = 0; i < sizeof(map_patches) / sizeof(map_patches[0]); ++i) {
+		err = map_save(&map, MAP_PATH);
+		assert(!err);
+		patch(MAP_PATH, map_patches[i].offset, map_patches[i].value);
+		err = map_load(&loaded_map, &image, MAP_PATH, longcmp, NULL);
+		assert(err == EINVAL);
+	}
+
+	// control bytes which would make probing go on forever, even with a consistent header
+	err = map_save(&map, MAP_PATH);
+	assert(!err);
+	const uint64_t capacity = map.buckets.capacity;
+	FILE *file = fopen(MAP_PATH, "r+b");
+	assert(file != NULL);
+	assert(fseek(file, peek(MAP_PATH, HEADER_CTRL_OFFSET), SEEK_SET) == 0);
+	for (uint64_t i = 0; i < capacity; ++i) assert(fputc(0x01, file) != EOF);
+	assert(fclose(file) == 0);
+	patch(MAP_PATH, HEADER_COUNT, capacity - 1);
+	patch(MAP_PATH, HEADER_FILLED, capacity - 1);
+	err = map_load(&loaded_map, &image, MAP_PATH, longcmp, NULL);
+	assert(err == EINVAL);
+
+	// both a header cut short and sections cut short
+	err = map_save(&map, MAP_PATH);
+	assert(!err);
+	assert(truncate(MAP_PATH, HEADER_LENGTH - 1) == 0);
+	err = map_load(&loaded_map, &image, MAP_PATH, longcmp, NULL);
+	assert(err == EINVAL);
+	err = map_save(&map, MAP_PATH);
+	assert(!err);
+	assert(truncate(MAP_PATH, HEADER_LENGTH + 64) == 0);
+	err = map_load(&loaded_map, &image, MAP_PATH, longcmp, NULL);
+	assert(err == EINVAL);
+
+	// a count which only fits because count * key_size wraps around
+	err = list_save(&list, LIST_PATH);
+	assert(!err);
+	patch(LIST_PATH, HEADER_KEY_SIZE, UINT64_MAX / 1000 + 1);
+	err = list_load(&loaded_list, &image, LIST_PATH);
+	assert(err == EINVAL);
+	err = list_save(&list, LIST_PATH);
+	assert(!err);
+	assert(truncate(LIST_PATH, HEADER_LENGTH + 64 + 100) == 0);
+	err = list_load(&loaded_list, &image, LIST_PATH);
+	assert(err == EINVAL);
+
+	list_destroy(&list);
+	map_destroy(&map);
+	remove(MAP_PATH);
+	remove(LIST_PATH);
+}
+
+static void maps(unsigned flags)
+{
+	map_t map;
+	err_t err = map_init(&map, 0, sizeof(long), sizeof(double), longcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+	err = map_set_flags(&map, flags);
+	assert(!err);
+
+	// leave an incremental rehash pending, which must be completed when saving
+	const long n = 5000;
+	for (long i = 0; i < n; ++i) {
+		const double value = i * 0.5;
+		err = map_insert(&map, &i, &value);
+		assert(!err);
+	}
+	for (long i = 0; i < n; i += 5) map_remove(&map, &i);
+
+	err = map_save(&map, MAP_PATH);
+	assert(!err);
+	assert(map.flags == flags);
+
+	map_t loaded;
+	image_t image;
+	err = map_load(&loaded, &image, MAP_PATH, longcmp, NULL);
+	assert(!err);
+	assert(map_size(&loaded) == map_size(&map));
+	for (long i = 0; i < n; ++i) {
+		const double *value = map_get(&loaded, &i);
+		if (i % 5 == 0) {
+			assert(value == NULL);
+		} else {
+			assert(value != NULL);
+			assert(*value == i * 0.5);
+		}
+	}
+	index_t visited = 0;
+	err = map_for_each(&loaded, check_entry, &visited);
+	assert(!err);
+	assert(visited == map_size(&map));
+
+	image_close(&image);
+	map_destroy(&map);
+	remove(MAP_PATH);
+}
+
+static void lists(void)
+{
+	list_t list;
+	err_t err = list_init(&list, 0, sizeof(int), STDLIB_ALLOCATOR);
+	assert(!err);
+	for (int i = 0; i < 1000; ++i) {
+		const int square = i * i;
+		err = list_append(&list, &square);
+		assert(!err);
+	}
+
+	err = list_save(&list, LIST_PATH);
+	assert(!err);
+
+	list_t loaded;
+	image_t image;
+	err = list_load(&loaded, &image, LIST_PATH);
+	assert(!err);
+	assert(list_size(&loaded) == list_size(&list));
+	for (int i = 0; i < 1000; ++i) assert(*(int *)list_ref(&loaded, i) == i * i);
+	image_close(&image);
+
+	// images are tagged with the kind of container they hold
+	map_t map;
+	err = map_load(&map, &image, LIST_PATH, longcmp, NULL);
+	assert(err == EINVAL);
+	err = list_load(&loaded, &image, "no such file");
+	assert(err == ENOENT);
+
+	list_destroy(&list);
+	remove(LIST_PATH);
+}
+
+int main(void)
+{
+	maps(0);
+	maps(MAP_INCREMENTAL_REHASH);
+	maps(MAP_ROBIN_HOOD);
+	lists();
+	corrupted();
+}
@@ -5,8 +5,12 @@
 
 #include <stdlib.h> // realloc, malloc, free, rand
 #include <string.h> // memcpy, strcmp
+#include <stdint.h> // uintptr_t
+#include <stdalign.h> // alignof
+#include <stddef.h> // max_align_t
 
 #include <ugly/core.h> // ARRAY_SIZE
+#include <ugly/alloc.h> // make_bump_allocator
 
 
 static void list_primitives(void)
@@ -73,6 +77,157 @@ static void list_pointers(void)
 	list_destroy(&names);
 }
 
+static void list_ranges(void)
+{
+	list_t numbers;
+	int err = list_init(&numbers, 0, sizeof(int), STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// build [0, 100) in three chunks, inserting the middle one last
+	int array[100];
+	for (int i = 0; i < 100; ++i) array[i] = i;
+	err = list_extend(&numbers, 30, &array[0]);
+	assert(!err);
+	err = list_extend(&numbers, 30, &array[70]);
+	assert(!err);
+	err = list_insert_range(&numbers, 30, 40, &array[30]);
+	assert(!err);
+	assert(list_size(&numbers) == 100);
+	for (int i = 0; i < 100; ++i) assert(*(int *)list_ref(&numbers, i) == i);
+
+	// pop a range from the middle, then everything but the ends
+	int sink[100];
+	list_remove_range(&numbers, 10, 20, sink);
+	for (int i = 0; i < 20; ++i) assert(sink[i] == 10 + i);
+	assert(list_size(&numbers) == 80);
+	assert(*(int *)list_ref(&numbers, 10) == 30);
+	list_remove_range(&numbers, 1, 78, NULL);
+	assert(list_size(&numbers) == 2);
+	assert(*(int *)list_ref(&numbers, 0) == 0);
+	assert(*(int *)list_ref(&numbers, 1) == 99);
+
+	// new elements from resizing are zeroed
+	err = list_resize(&numbers, 50);
+	assert(!err);
+	assert(list_size(&numbers) == 50);
+	assert(*(int *)list_ref(&numbers, 1) == 99);
+	for (int i = 2; i < 50; ++i) assert(*(int *)list_ref(&numbers, i) == 0);
+	err = list_resize(&numbers, 1);
+	assert(!err);
+	assert(list_size(&numbers) == 1);
+	assert(*(int *)list_ref(&numbers, 0) == 0);
+
+	list_destroy(&numbers);
+}
+
+static int reallocs = 0;
+
+static void *counting_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	reallocs++;
+	return realloc(ptr, size);
+}
+
+static void list_policies(void)
+{
+	const struct allocator counting = { .method = counting_alloc };
+	list_t numbers;
+	int err = list_init(&numbers, 0, sizeof(int), counting);
+	assert(!err);
+
+	// reserving once means no reallocations until that capacity is reached
+	err = list_reserve(&numbers, 1000);
+	assert(!err);
+	assert(numbers.capacity == 1000);
+	reallocs = 0;
+	for (int i = 0; i < 1000; ++i) {
+		err = list_append(&numbers, &i);
+		assert(!err);
+	}
+	assert(reallocs == 0);
+
+	// with auto-shrinking disabled, oscillating around any length never reallocates
+	list_set_policy(&numbers, (struct list_policy){
+		.growth_factor = 2.0, .min_capacity = 16, .shrink = false,
+	});
+	int sink;
+	for (int round = 0; round < 100; ++round) {
+		for (int i = 0; i < 990; ++i) list_remove(&numbers, numbers.length - 1, &sink);
+		for (int i = 0; i < 990; ++i) list_append(&numbers, &i);
+	}
+	assert(reallocs == 0);
+	assert(numbers.capacity == 1000);
+
+	// explicitly shrinking still works, down to the minimum capacity
+	list_remove_range(&numbers, 0, 995, NULL);
+	err = list_shrink_to_fit(&numbers);
+	assert(!err);
+	assert(numbers.capacity == 16);
+	assert(*(int *)list_ref(&numbers, 4) == 989);
+
+	// growth goes by the policy's factor
+	err = list_resize(&numbers, 17);
+	assert(!err);
+	assert(numbers.capacity == 32);
+
+	// default policy shrinks once usage is low enough
+	list_set_policy(&numbers, LIST_DEFAULT_POLICY);
+	list_remove_range(&numbers, 0, 15, NULL);
+	assert(numbers.capacity < 32);
+	assert(numbers.capacity >= LIST_MIN_CAPACITY);
+
+	list_destroy(&numbers);
+}
+
+// Fresh blocks are cache-line aligned, but growing them may well lose that.
+static void *aligned_fresh_alloc(struct allocator *ctx, void *ptr, size_t size)
+{
+	if (ptr == NULL && size != 0) return aligned_alloc(64, (size + 63) / 64 * 64);
+	return realloc(ptr, size);
+}
+
+static void list_alignment(void)
+{
+	// list capacity takes up any slack the allocator gives it
+	byte_t buffer[1024];
+	bump_allocator_t bump;
+	list_t bytes;
+	int err = list_init(&bytes, 3, sizeof(byte_t), make_bump_allocator(&bump, buffer, sizeof(buffer)));
+	assert(!err);
+	assert(bytes.capacity >= 3);
+	assert(bytes.capacity % alignof(max_align_t) == 0);
+	list_destroy(&bytes);
+
+	// and storage can be aligned to something bigger
+	list_t numbers;
+	err = list_init(&numbers, 0, sizeof(double), (struct allocator){0});
+	assert(!err);
+	struct list_policy policy = LIST_DEFAULT_POLICY;
+	policy.alignment = 64;
+	list_set_policy(&numbers, policy);
+	for (int i = 0; i < 1000; ++i) {
+		const double x = i;
+		err = list_append(&numbers, &x);
+		assert(!err);
+		assert((uintptr_t)numbers.data % 64 == 0);
+	}
+	for (int i = 0; i < 1000; ++i) assert(*(double *)list_ref(&numbers, i) == i);
+	list_destroy(&numbers);
+
+	// even when the allocator has no aligned reallocations of its own
+	err = list_init(&numbers, 0, sizeof(double), (struct allocator){ .method = aligned_fresh_alloc });
+	assert(!err);
+	list_set_policy(&numbers, policy);
+	for (int i = 0; i < 1000; ++i) {
+		const double x = i;
+		err = list_append(&numbers, &x);
+		assert(!err);
+		assert((uintptr_t)numbers.data % 64 == 0);
+	}
+	for (int i = 0; i < 1000; ++i) assert(*(double *)list_ref(&numbers, i) == i);
+	list_destroy(&numbers);
+}
+
 static int strrefcmp(const void *a, const void *b)
 {
 	const char *str1 = *(const char **)a;
@@ -134,5 +289,8 @@ int main(void)
 {
 	list_primitives();
 	list_pointers();
+	list_ranges();
+	list_policies();
+	list_alignment();
 	list_sorting();
 }
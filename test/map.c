@@ -11,6 +11,7 @@
 
 #include <ugly/core.h> // ARRAY_SIZE
 #include <ugly/hash.h> // fnv_1a
+#include <ugly/alloc.h> // make_pool_allocator
 
 
 static int strrefcmp(const void *a, const void *b)
@@ -96,6 +97,190 @@ void test(void)
 }
 
 
+static int intrefcmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int count_each(const void *key, void *value, void *counter)
+{
+	assert(*(const int *)key + 1 == *(int *)value);
+	*(index_t *)counter += 1;
+	return 0;
+}
+
+void churn(unsigned flags)
+{
+#define KEYS 4096
+	int expected[KEYS] = {0}; // zero means absent, otherwise key + 1
+	map_t dict;
+	err_t err = map_init(&dict, 0, sizeof(int), sizeof(int),
+	                     intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+	err = map_set_flags(&dict, flags);
+	assert(!err);
+
+	// randomly insert and remove keys, checking against the expected mapping
+	index_t count = 0;
+	for (int i = 0; i < 64 * KEYS; ++i) {
+		const int key = rand() % KEYS;
+		if (rand() % 3) {
+			const int value = key + 1;
+			err = map_insert(&dict, &key, &value);
+			assert(expected[key] ? err < 0 : err == 0);
+			if (!expected[key]) count++;
+			expected[key] = value;
+		} else {
+			err = map_remove(&dict, &key);
+			assert(expected[key] ? err == 0 : err == ENOKEY);
+			if (expected[key]) count--;
+			expected[key] = 0;
+		}
+		assert(map_size(&dict) == count);
+	}
+
+	index_t visited = 0;
+	err = map_for_each(&dict, count_each, &visited);
+	assert(!err);
+	assert(visited == count);
+
+	// switching the probing scheme shouldn't lose any entries
+	err = map_set_flags(&dict, flags ^ MAP_ROBIN_HOOD);
+	assert(!err);
+	assert(map_size(&dict) == count);
+
+	for (int key = 0; key < KEYS; ++key) {
+		const int *value = map_get(&dict, &key);
+		assert(expected[key] ? *value == expected[key] : value == NULL);
+	}
+
+	map_destroy(&dict);
+#undef KEYS
+}
+
+void compaction(void)
+{
+#define LIVE 1100
+	map_t dict;
+	err_t err = map_init(&dict, 0, sizeof(int), sizeof(int),
+	                     intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// churning at a constant size shouldn't keep growing the table
+	for (int i = 0; i < 1000 * LIVE; ++i) {
+		err = map_insert(&dict, &i, &i);
+		assert(!err);
+		if (i >= LIVE) {
+			const int old = i - LIVE;
+			err = map_remove(&dict, &old);
+			assert(!err);
+		}
+	}
+	assert(map_size(&dict) == LIVE);
+	assert(dict.buckets.capacity <= 2048);
+	map_destroy(&dict);
+
+	// after lots of removals, compaction should shrink the table
+	err = map_init(&dict, 0, sizeof(int), sizeof(int),
+	               intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+	for (int i = 0; i < LIVE; ++i) map_insert(&dict, &i, &i);
+	const index_t capacity = dict.buckets.capacity;
+	for (int i = 0; i < LIVE; ++i) if (i % 4) map_remove(&dict, &i);
+	err = map_compact(&dict);
+	assert(!err);
+	assert(dict.buckets.capacity < capacity);
+	for (int i = 0; i < LIVE; ++i) {
+		const int *value = map_get(&dict, &i);
+		assert(i % 4 ? value == NULL : *value == i);
+	}
+
+	map_destroy(&dict);
+#undef LIVE
+}
+
+void counters(void)
+{
+	const char *words[] = {"a", "b", "a", "c", "b", "a"};
+	map_t counts;
+	err_t err = map_init(&counts, 0, sizeof(char *), sizeof(int),
+	                     strrefcmp, strhash, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// count occurrences without a separate lookup
+	for (int i = 0; i < ARRAY_SIZE(words); ++i) {
+		bool created;
+		int *count = map_upsert(&counts, &words[i], &created);
+		assert(count != NULL);
+		if (created) *count = 0;
+		*count += 1;
+	}
+
+	assert(map_size(&counts) == 3);
+	assert(*(int *)map_get(&counts, &words[0]) == 3);
+	assert(*(int *)map_get(&counts, &words[1]) == 2);
+	assert(*(int *)map_get(&counts, &words[3]) == 1);
+
+	map_destroy(&counts);
+}
+
+void statistics(void)
+{
+	map_t dict;
+	err_t err = map_init(&dict, 0, sizeof(int), sizeof(int),
+	                     intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	for (int i = 0; i < 100; ++i) map_insert(&dict, &i, &i);
+	for (int i = 0; i < 200; ++i) map_get(&dict, &i);
+
+	const struct map_stats stats = map_stats(&dict);
+	assert(stats.bytes >= dict.buckets.capacity * (sizeof(int) + sizeof(int)));
+	assert(stats.tombstones == 0);
+#ifdef UGLY_MAP_STATS
+	assert(stats.lookups == 300);
+	assert(stats.hits == 100);
+	assert(stats.misses == 200);
+	assert(stats.probes >= stats.lookups);
+	assert(stats.max_probe >= 1);
+	assert(stats.rehashes > 0);
+#endif
+
+	map_destroy(&dict);
+}
+
+void batch(void)
+{
+#define N 1000
+	int keys[N], values[N];
+	for (int i = 0; i < N; ++i) {
+		keys[i] = 2 * i; // only even numbers are mapped
+		values[i] = -i;
+	}
+
+	map_t dict;
+	err_t err = map_init(&dict, 0, sizeof(int), sizeof(int),
+	                     intrefcmp, NULL, STDLIB_ALLOCATOR);
+	assert(!err);
+	err = map_insert_many(&dict, N, keys, values);
+	assert(!err);
+	assert(map_size(&dict) == N);
+
+	// query both even and odd numbers
+	for (int i = 0; i < N; ++i) keys[i] = i;
+	void *found[N];
+	const index_t hits = map_get_many(&dict, N, keys, found);
+	assert(hits == N / 2);
+	for (int i = 0; i < N; ++i) {
+		if (i % 2) assert(found[i] == NULL);
+		else assert(*(int *)found[i] == -i / 2);
+	}
+
+	map_destroy(&dict);
+#undef N
+}
+
+
 static int ulongrefcmp(const void *a, const void *b)
 {
 	return *(const unsigned long *)a - *(const unsigned long *)b;
@@ -107,6 +292,23 @@ static hash_t ulonghash(const void *ptr, size_t bytes)
 	return n * n;
 }
 
+void pooled(void)
+{
+	// bucket arrays may be cache-aligned, but allocators which can't do that still work
+	static byte_t buffer[64 * 1024];
+	pool_allocator_t pool;
+	map_t dict;
+	int err = map_init(&dict, 0, sizeof(int), sizeof(int), intrefcmp, NULL,
+	                   make_pool_allocator(&pool, buffer, sizeof(buffer), 4096));
+	assert(!err);
+	for (int i = 0; i < 100; ++i) {
+		err = map_insert(&dict, &i, &i);
+		assert(!err);
+	}
+	for (int i = 0; i < 100; ++i) assert(*(int *)map_get(&dict, &i) == i);
+	map_destroy(&dict);
+}
+
 void benchmark(int n, int reserve)
 {
 	n = n > 0 ? n : 1000000;
@@ -139,6 +341,15 @@ int main(int argc, char const *argv[])
 	int reserve = argc > 2 ? atoi(argv[2]) : 0;
 
 	test();
+	churn(0);
+	churn(MAP_INCREMENTAL_REHASH);
+	churn(MAP_ROBIN_HOOD);
+	churn(MAP_ROBIN_HOOD | MAP_INCREMENTAL_REHASH);
+	compaction();
+	counters();
+	statistics();
+	batch();
+	pooled();
 	benchmark(n, reserve);
 
 	return 0;
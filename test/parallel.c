@@ -0,0 +1,136 @@
+#include <ugly/parallel.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdlib.h> // rand
+#include <stdio.h> // printf
+#include <time.h> // clock
+
+#include <ugly/core.h>
+#include <ugly/list.h>
+#include <ugly/sort.h>
+
+
+static int longcmp(const void *a, const void *b)
+{
+	const long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+static void square(void *element, void *forward)
+{
+	long *x = element;
+	*x = *x * *x;
+}
+
+static void halve(const void *in, void *out, void *forward)
+{
+	*(double *)out = *(const long *)in * 0.5;
+}
+
+static void add(void *acc, const void *element, void *forward)
+{
+	*(long *)acc += *(const long *)element;
+}
+
+static void count_odd(void *acc, const void *element, void *forward)
+{
+	*(long *)acc += *(const long *)element % 2 != 0;
+}
+
+static void numbers(index_t n, unsigned threads)
+{
+	list_t list, halves;
+	err_t err = list_init(&list, n, sizeof(long), STDLIB_ALLOCATOR);
+	assert(!err);
+	err = list_init(&halves, 0, sizeof(double), STDLIB_ALLOCATOR);
+	assert(!err);
+	for (long i = 0; i < n; ++i) {
+		err = list_append(&list, &i);
+		assert(!err);
+	}
+
+	parallel_for_each(&list, threads, square, NULL);
+	for (long i = 0; i < n; ++i) assert(*(long *)list_ref(&list, i) == i * i);
+
+	err = parallel_transform(&list, &halves, threads, halve, NULL);
+	assert(!err);
+	assert(list_size(&halves) == n);
+	for (long i = 0; i < n; ++i) assert(*(double *)list_ref(&halves, i) == i * i * 0.5);
+
+	long sum = 0, odd = 0;
+	err = parallel_reduce(&list, threads, &sum, sizeof(long), add, add, NULL);
+	assert(!err);
+	assert(sum == (n - 1) * n * (2 * n - 1) / 6);
+	err = parallel_reduce(&list, threads, &odd, sizeof(long), count_odd, add, NULL);
+	assert(!err);
+	assert(odd == n / 2);
+
+	list_destroy(&halves);
+	list_destroy(&list);
+}
+
+static void sorting(index_t n, unsigned threads, long range)
+{
+	list_t list;
+	err_t err = list_init(&list, n, sizeof(long), STDLIB_ALLOCATOR);
+	assert(!err);
+	long sum = 0;
+	for (index_t i = 0; i < n; ++i) {
+		const long x = rand() % range;
+		sum += x;
+		err = list_append(&list, &x);
+		assert(!err);
+	}
+
+	err = parallel_sort(&list, threads, longcmp);
+	assert(!err);
+	assert(list_size(&list) == n);
+	long check = 0;
+	for (index_t i = 0; i < n; ++i) {
+		check += *(long *)list_ref(&list, i);
+		if (i > 0) assert(longcmp(list_ref(&list, i - 1), list_ref(&list, i)) <= 0);
+	}
+	assert(check == sum);
+
+	list_destroy(&list);
+}
+
+static void benchmark(index_t n)
+{
+	list_t list;
+	err_t err = list_init(&list, n, sizeof(long), STDLIB_ALLOCATOR);
+	assert(!err);
+
+	for (int parallel = 0; parallel < 2; ++parallel) {
+		list.length = 0;
+		for (index_t i = 0; i < n; ++i) {
+			const long x = rand();
+			list_append(&list, &x);
+		}
+		struct timespec begin, end;
+		timespec_get(&begin, TIME_UTC);
+		if (parallel) parallel_sort(&list, 0, longcmp);
+		else list_sort(&list, longcmp);
+		timespec_get(&end, TIME_UTC);
+		const double elapsedMs = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+		printf("%s: %.3f ms\n", parallel ? "parallel_sort" : "list_sort", elapsedMs);
+	}
+
+	list_destroy(&list);
+}
+
+int main(void)
+{
+	const unsigned threads[] = {1, 3, 8, 0};
+	for (int t = 0; t < ARRAY_SIZE(threads); ++t) {
+		numbers(10, threads[t]);
+		numbers(100000, threads[t]);
+		sorting(0, threads[t], 10);
+		sorting(1000, threads[t], 10);
+		sorting(100003, threads[t], 10); // lots of ties between runs
+		sorting(100003, threads[t], RAND_MAX);
+	}
+	benchmark(2000000);
+}
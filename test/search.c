@@ -0,0 +1,130 @@
+#include <ugly/search.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdlib.h> // rand, malloc, free, bsearch
+#include <stdio.h> // printf
+#include <time.h> // clock
+
+#include <ugly/core.h>
+#include <ugly/list.h>
+
+
+struct record {
+	int key;
+	char payload[12];
+};
+
+// keys and elements have different types, just like with bsearch
+static int keycmp(const void *key, const void *element)
+{
+	const int x = *(const int *)key, y = ((const struct record *)element)->key;
+	return (x > y) - (x < y);
+}
+
+static int intcmp(const void *a, const void *b)
+{
+	const int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+static index_t naive_lower_bound(const struct record *records, index_t n, int key)
+{
+	index_t i = 0;
+	while (i < n && records[i].key < key) ++i;
+	return i;
+}
+
+static void bounds(index_t n)
+{
+	// sorted keys with gaps and duplicates
+	list_t list;
+	err_t err = list_init(&list, n, sizeof(struct record), STDLIB_ALLOCATOR);
+	assert(!err);
+	for (index_t i = 0, key = 0; i < n; ++i) {
+		key += rand() % 3;
+		const struct record r = { .key = key };
+		err = list_append(&list, &r);
+		assert(!err);
+	}
+	const struct record *records = (const struct record *)list.data;
+	const int max = n > 0 ? records[n - 1].key : 0;
+
+	search_tree_t tree;
+	err = search_tree_init(&tree, records, n, sizeof(struct record), keycmp, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	int keys[64];
+	index_t found[64];
+	for (int key = -1; key <= max + 1; key += 64) {
+		for (int k = 0; k < 64; ++k) keys[k] = key + k;
+		search_tree_lower_bound_many(&tree, 64, keys, sizeof(int), found);
+		for (int k = 0; k < 64; ++k) {
+			const index_t expected = naive_lower_bound(records, n, keys[k]);
+			assert(list_lower_bound(&list, &keys[k], keycmp) == expected);
+			assert(search_tree_lower_bound(&tree, &keys[k]) == expected);
+			assert(found[k] == expected);
+
+			const index_t i = list_search(&list, &keys[k], keycmp);
+			if (expected < n && records[expected].key == keys[k]) assert(i == expected);
+			else assert(i < 0);
+		}
+	}
+
+	search_tree_destroy(&tree);
+	list_destroy(&list);
+}
+
+static void benchmark(index_t n, index_t queries)
+{
+	int *sorted = malloc(n * sizeof(int)), *keys = malloc(queries * sizeof(int));
+	index_t *found = malloc(queries * sizeof(index_t));
+	assert(sorted != NULL && keys != NULL && found != NULL);
+	for (index_t i = 0; i < n; ++i) sorted[i] = 2 * i;
+	for (index_t q = 0; q < queries; ++q) keys[q] = rand() % (2 * n);
+
+	search_tree_t tree;
+	err_t err = search_tree_init(&tree, sorted, n, sizeof(int), intcmp, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	const char *names[] = {"bsearch", "search_lower_bound", "search_tree_lower_bound",
+	                       "search_tree_lower_bound_many"};
+	for (int algorithm = 0; algorithm < 4; ++algorithm) {
+		const clock_t begin = clock();
+		switch (algorithm) {
+		case 0:
+			for (index_t q = 0; q < queries; ++q) {
+				const int *hit = bsearch(&keys[q], sorted, n, sizeof(int), intcmp);
+				found[q] = hit != NULL ? hit - sorted : -1;
+			}
+			break;
+		case 1:
+			for (index_t q = 0; q < queries; ++q)
+				found[q] = search_lower_bound(sorted, n, sizeof(int), &keys[q], intcmp);
+			break;
+		case 2:
+			for (index_t q = 0; q < queries; ++q)
+				found[q] = search_tree_lower_bound(&tree, &keys[q]);
+			break;
+		case 3:
+			search_tree_lower_bound_many(&tree, queries, keys, sizeof(int), found);
+			break;
+		}
+		const clock_t end = clock();
+		const float elapsedNs = end*1e9/CLOCKS_PER_SEC - begin*1e9/CLOCKS_PER_SEC;
+		printf("%s: %.0f ns per query\n", names[algorithm], elapsedNs / queries);
+	}
+
+	search_tree_destroy(&tree);
+	free(sorted);
+	free(keys);
+	free(found);
+}
+
+int main(void)
+{
+	for (index_t n = 0; n < 70; ++n) bounds(n);
+	bounds(10000);
+	benchmark(1 << 22, 1000000);
+}
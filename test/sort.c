@@ -0,0 +1,207 @@
+#include <ugly/sort.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdint.h>
+#include <stdlib.h> // rand, qsort, malloc, free
+#include <string.h> // memcmp, memcpy
+#include <stdio.h> // printf
+#include <time.h> // clock
+
+#include <ugly/core.h>
+#include <ugly/list.h>
+
+
+struct record {
+	int32_t key;
+	uint32_t order; // original position, to check for stability
+	double payload;
+};
+
+static int u32cmp(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int u64cmp(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int recordcmp(const void *a, const void *b)
+{
+	const struct record *x = a, *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static uint64_t record_key(const void *element)
+{
+	const struct record *r = element;
+	return (uint32_t)r->key ^ (uint32_t)1 << 31; // signed -> unsigned order
+}
+
+static void check_stable(const struct record *records, index_t n)
+{
+	for (index_t i = 1; i < n; ++i) {
+		assert(records[i - 1].key <= records[i].key);
+		if (records[i - 1].key == records[i].key)
+			assert(records[i - 1].order < records[i].order);
+	}
+}
+
+static void integers(index_t n)
+{
+	uint32_t *u32 = malloc(n * sizeof(uint32_t)), *expected32 = malloc(n * sizeof(uint32_t));
+	uint64_t *u64 = malloc(n * sizeof(uint64_t)), *expected64 = malloc(n * sizeof(uint64_t));
+	assert(u32 && expected32 && u64 && expected64);
+
+	for (index_t i = 0; i < n; ++i) {
+		expected32[i] = i % 7 == 0 ? 42 : (uint32_t)rand() << 8 ^ rand(); // some duplicates
+		expected64[i] = (uint64_t)rand() << 40 ^ (uint64_t)rand() << 20 ^ rand();
+	}
+	qsort(expected32, n, sizeof(uint32_t), u32cmp);
+	qsort(expected64, n, sizeof(uint64_t), u64cmp);
+
+	// each algorithm gets a fresh shuffle of the expected output
+	for (int algorithm = 0; algorithm < 3; ++algorithm) {
+		memcpy(u32, expected32, n * sizeof(uint32_t));
+		memcpy(u64, expected64, n * sizeof(uint64_t));
+		for (index_t i = n - 1; i > 0; --i) {
+			const index_t j = rand() % (i + 1);
+			memswap(&u32[i], &u32[j], sizeof(uint32_t));
+			memswap(&u64[i], &u64[j], sizeof(uint64_t));
+		}
+
+		err_t err = 0;
+		switch (algorithm) {
+		case 0:
+			sort_intro(u32, n, sizeof(uint32_t), u32cmp);
+			sort_intro(u64, n, sizeof(uint64_t), u64cmp);
+			break;
+		case 1:
+			err = sort_merge(u32, n, sizeof(uint32_t), u32cmp, STDLIB_ALLOCATOR);
+			err |= sort_merge(u64, n, sizeof(uint64_t), u64cmp, STDLIB_ALLOCATOR);
+			break;
+		case 2:
+			err = sort_radix(u32, n, sizeof(uint32_t), NULL, 32, STDLIB_ALLOCATOR);
+			err |= sort_radix(u64, n, sizeof(uint64_t), NULL, 64, STDLIB_ALLOCATOR);
+			break;
+		}
+		assert(!err);
+		assert(memcmp(u32, expected32, n * sizeof(uint32_t)) == 0);
+		assert(memcmp(u64, expected64, n * sizeof(uint64_t)) == 0);
+	}
+
+	free(u32);
+	free(expected32);
+	free(u64);
+	free(expected64);
+}
+
+static void records(index_t n)
+{
+	list_t list;
+	err_t err = list_init(&list, n, sizeof(struct record), STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// few distinct keys (including negative ones) means lots of ties
+	for (int algorithm = 0; algorithm < 3; ++algorithm) {
+		list.length = 0;
+		for (index_t i = 0; i < n; ++i) {
+			const struct record r = { .key = rand() % 100 - 50, .order = i, .payload = i };
+			err = list_append(&list, &r);
+			assert(!err);
+		}
+
+		switch (algorithm) {
+		case 0:
+			list_sort(&list, recordcmp);
+			for (index_t i = 1; i < n; ++i)
+				assert(recordcmp(list_ref(&list, i - 1), list_ref(&list, i)) <= 0);
+			break;
+		case 1:
+			err = list_stable_sort(&list, recordcmp);
+			assert(!err);
+			check_stable((struct record *)list.data, n);
+			break;
+		case 2:
+			err = list_radix_sort(&list, record_key, 32);
+			assert(!err);
+			check_stable((struct record *)list.data, n);
+			break;
+		}
+	}
+
+	list_destroy(&list);
+}
+
+static void partial_keys(void)
+{
+	// bits above the 12-bit keys hold each element's original position, which
+	// isn't part of the key, so the sort must be stable with respect to them
+	const index_t n = 10000;
+	uint32_t *data = malloc(n * sizeof(uint32_t));
+	assert(data != NULL);
+	for (index_t i = 0; i < n; ++i) data[i] = (uint32_t)i << 12 | rand() % 4096;
+	const err_t err = sort_radix(data, n, sizeof(uint32_t), NULL, 12, STDLIB_ALLOCATOR);
+	assert(!err);
+	for (index_t i = 1; i < n; ++i) {
+		const uint32_t previous = data[i - 1] & 0xFFF, current = data[i] & 0xFFF;
+		assert(previous <= current);
+		if (previous == current) assert(data[i - 1] >> 12 < data[i] >> 12);
+	}
+	free(data);
+}
+
+static void adversarial(void)
+{
+	// sorted, reversed and constant inputs are classic quicksort pitfalls
+	const index_t n = 100000;
+	uint32_t *data = malloc(n * sizeof(uint32_t));
+	assert(data != NULL);
+	for (int pattern = 0; pattern < 3; ++pattern) {
+		for (index_t i = 0; i < n; ++i) data[i] = pattern == 0 ? i : pattern == 1 ? n - i : 7;
+		sort_intro(data, n, sizeof(uint32_t), u32cmp);
+		for (index_t i = 1; i < n; ++i) assert(data[i - 1] <= data[i]);
+	}
+	free(data);
+}
+
+static void benchmark(index_t n)
+{
+	uint64_t *original = malloc(n * sizeof(uint64_t)), *data = malloc(n * sizeof(uint64_t));
+	assert(original != NULL && data != NULL);
+	for (index_t i = 0; i < n; ++i)
+		original[i] = (uint64_t)rand() << 40 ^ (uint64_t)rand() << 20 ^ rand();
+
+	const char *names[] = {"qsort", "sort_intro", "sort_merge", "sort_radix"};
+	for (int algorithm = 0; algorithm < 4; ++algorithm) {
+		memcpy(data, original, n * sizeof(uint64_t));
+		const clock_t begin = clock();
+		switch (algorithm) {
+		case 0: qsort(data, n, sizeof(uint64_t), u64cmp); break;
+		case 1: sort_intro(data, n, sizeof(uint64_t), u64cmp); break;
+		case 2: sort_merge(data, n, sizeof(uint64_t), u64cmp, STDLIB_ALLOCATOR); break;
+		case 3: sort_radix(data, n, sizeof(uint64_t), NULL, 64, STDLIB_ALLOCATOR); break;
+		}
+		const clock_t end = clock();
+		const float elapsedNs = end*1e9/CLOCKS_PER_SEC - begin*1e9/CLOCKS_PER_SEC;
+		printf("%s: %.3f ms\n", names[algorithm], elapsedNs / 1e6);
+	}
+
+	free(original);
+	free(data);
+}
+
+int main(void)
+{
+	for (index_t n = 0; n < 40; ++n) integers(n);
+	integers(100000);
+	records(50000);
+	partial_keys();
+	adversarial();
+	benchmark(1000000);
+}
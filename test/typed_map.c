@@ -0,0 +1,109 @@
+#include <ugly/typed_map.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <string.h> // strcmp
+#include <stdlib.h> // rand
+#include <errno.h>
+
+#include <ugly/core.h> // ARRAY_SIZE
+#include <ugly/hash.h> // fnv_1a
+
+
+static inline hash_t int_hash(int x)
+{
+	return x;
+}
+
+#define INT_EQ(a, b) ((a) == (b))
+
+UGLY_MAP_DEFINE(intmap, int, long, int_hash, INT_EQ)
+
+static void integers(void)
+{
+#define KEYS 4096
+	long expected[KEYS] = {0}; // zero means absent
+	intmap_t map;
+	err_t err = intmap_init(&map, 0, STDLIB_ALLOCATOR);
+	assert(!err);
+
+	// randomly insert and remove keys, checking against the expected mapping
+	index_t count = 0;
+	for (int i = 0; i < 64 * KEYS; ++i) {
+		const int key = rand() % KEYS;
+		if (rand() % 3) {
+			err = intmap_insert(&map, key, -key - 1);
+			assert(expected[key] ? err < 0 : err == 0);
+			if (!expected[key]) count++;
+			expected[key] = -key - 1;
+		} else {
+			err = intmap_remove(&map, key);
+			assert(expected[key] ? err == 0 : err == ENOKEY);
+			if (expected[key]) count--;
+			expected[key] = 0;
+		}
+		assert(intmap_size(&map) == count);
+	}
+
+	for (int key = 0; key < KEYS; ++key) {
+		const long *value = intmap_get(&map, key);
+		assert(expected[key] ? *value == expected[key] : value == NULL);
+	}
+
+	intmap_destroy(&map);
+#undef KEYS
+}
+
+
+struct name { char first[16]; char last[16]; };
+
+static inline hash_t name_hash(struct name n)
+{
+	return fnv_1a(&n, sizeof(n));
+}
+
+static inline bool name_eq(struct name a, struct name b)
+{
+	return strcmp(a.first, b.first) == 0 && strcmp(a.last, b.last) == 0;
+}
+
+UGLY_MAP_DEFINE(agemap, struct name, int, name_hash, name_eq)
+
+static void structs(void)
+{
+	const struct name names[] = {
+		{ "Alyssa", "Hacker" },
+		{ "Ben", "Bitdiddle" },
+		{ "Louis", "Reasoner" },
+	};
+
+	agemap_t ages;
+	err_t err = agemap_init(&ages, ARRAY_SIZE(names), STDLIB_ALLOCATOR);
+	assert(!err);
+
+	for (int i = 0; i < ARRAY_SIZE(names); ++i) {
+		err = agemap_insert(&ages, names[i], 20 + i);
+		assert(!err);
+	}
+
+	// bump everyone's age in place
+	for (int i = 0; i < ARRAY_SIZE(names); ++i) {
+		bool created;
+		int *age = agemap_upsert(&ages, names[i], &created);
+		assert(!created);
+		*age += 1;
+	}
+
+	const struct name unknown = { "Eva", "Lu Ator" };
+	assert(agemap_get(&ages, unknown) == NULL);
+	assert(*agemap_get(&ages, names[1]) == 22);
+
+	agemap_destroy(&ages);
+}
+
+int main(void)
+{
+	integers();
+	structs();
+}